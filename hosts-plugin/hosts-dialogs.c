@@ -2,6 +2,7 @@
 #include <config.h>
 #endif
 
+#include <stdlib.h>
 #include <string.h>
 #include <gtk/gtk.h>
 
@@ -10,6 +11,10 @@
 
 #include "hosts.h"
 #include "hosts-dialogs.h"
+#include "hosts-propagate.h"
+#include "hosts-shared.h"
+#include "hosts-sources.h"
+#include "hosts-state.h"
 
 #define PLUGIN_WEBSITE "https://github.com/Azmisov/xfce-hosts-plugin"
 
@@ -19,6 +24,8 @@ typedef struct {
 	GtkWidget *listbox;
 	// widget to add another hostname
 	GtkWidget *entry;
+	// widget to hold list of external sources
+	GtkWidget *sources_listbox;
 } HostsDialogData;
 
 static gboolean is_valid_hostname(const gchar *hostname) {
@@ -79,6 +86,8 @@ static void hosts_configure_response(GtkWidget *dialog, gint response, HostsPlug
 	else {
 		// remove the dialog data from the plugin
 		g_object_set_data(G_OBJECT(hosts->plugin), "dialog", NULL);
+		g_object_set_data(G_OBJECT(hosts->plugin), "aliases-listbox", NULL);
+		g_object_set_data(G_OBJECT(hosts->plugin), "sources-listbox", NULL);
 
 		// unlock the panel menu
 		xfce_panel_plugin_unblock_menu(hosts->plugin);
@@ -92,7 +101,7 @@ static void hosts_configure_response(GtkWidget *dialog, gint response, HostsPlug
 }
 
 // Add new alias to the listbox widget. Returns the newly added row. Set index to -1 to append
-static GtkWidget* hosts_add_listbox_item(GtkWidget *listbox, gchar *text, gint index) {
+static GtkWidget* hosts_add_listbox_item(GtkWidget *listbox, const gchar *text, gint index) {
 	GtkWidget *row = gtk_list_box_row_new();
 	GtkWidget *label = gtk_label_new(text);
 	gtk_widget_set_halign(label, GTK_ALIGN_START);
@@ -102,6 +111,20 @@ static GtkWidget* hosts_add_listbox_item(GtkWidget *listbox, gchar *text, gint i
 	return row;
 }
 
+// Add the alias at index i of the hosts list to the listbox, flagging it if it's mapped elsewhere in
+// /etc/hosts. Returns the newly added row. Set position to -1 to append
+static GtkWidget* hosts_add_alias_item(HostsPlugin *hosts, GtkWidget *listbox, guint i, gint position) {
+	gchar *conflict = hosts_conflict_describe(hosts, hosts_name(hosts, i));
+	if (!conflict)
+		return hosts_add_listbox_item(listbox, hosts_name(hosts, i), position);
+	gchar *text = g_strdup_printf("%s \xe2\x9a\xa0", hosts_name(hosts, i));
+	GtkWidget *row = hosts_add_listbox_item(listbox, text, position);
+	gtk_widget_set_tooltip_text(row, conflict);
+	g_free(text);
+	g_free(conflict);
+	return row;
+}
+
 // Add another hostname alias to the list
 static void hosts_add_alias(GtkButton *button, gpointer user_data) {
 	HostsDialogData *data = (HostsDialogData *) user_data;
@@ -119,42 +142,86 @@ static void hosts_add_alias(GtkButton *button, gpointer user_data) {
 	}
 
 	// validate hostname is unique
-	if (data->hosts->names != NULL) {
-		for (gint i=0; data->hosts->names[i]; i++) {
-			if (g_strcmp0(data->hosts->names[i], new_alias) == 0) {
-				GtkWidget *message_dialog = gtk_message_dialog_new(
-					NULL, GTK_DIALOG_DESTROY_WITH_PARENT, GTK_MESSAGE_ERROR, GTK_BUTTONS_CLOSE,
-					"Hostname already added: %s", new_alias
-				);
-				gtk_dialog_run(GTK_DIALOG(message_dialog));
-				gtk_widget_destroy(message_dialog);
-				return;
-			}
-		}
-	}
-
-	// Get the current length of the names array
-	gint length = 0;
-	while (data->hosts->names && data->hosts->names[length]) {
-		length++;
+	if (hosts_find(data->hosts, new_alias) >= 0) {
+		GtkWidget *message_dialog = gtk_message_dialog_new(
+			NULL, GTK_DIALOG_DESTROY_WITH_PARENT, GTK_MESSAGE_ERROR, GTK_BUTTONS_CLOSE,
+			"Hostname already added: %s", new_alias
+		);
+		gtk_dialog_run(GTK_DIALOG(message_dialog));
+		gtk_widget_destroy(message_dialog);
+		return;
 	}
 
-	// Reallocate memory for the new alias
-	data->hosts->names = g_realloc(data->hosts->names, (length + 2) * sizeof(gchar *));
-	data->hosts->names[length] = g_strdup(new_alias);
-	data->hosts->names[length + 1] = NULL;
-
-	// Reallocate memory for the enabled array; length is given by names array
-	data->hosts->enabled = g_realloc(data->hosts->enabled, (length + 1) * sizeof(gboolean));
-	data->hosts->enabled[length] = FALSE;
+	// Append to the packed names, disabled
+	hosts_append(data->hosts, new_alias);
 
 	// Add to listbox widget
-	hosts_add_listbox_item(data->listbox, data->hosts->names[length], -1);
+	hosts_add_alias_item(data->hosts, data->listbox, data->hosts->n_names - 1, -1);
 
 	// Clear the entry
 	gtk_entry_set_text(GTK_ENTRY(data->entry), "");
 }
 
+// A host or source being deleted, once the write lock is free. Its listbox row is removed along
+// with it, from whichever configure dialog is open by then; until then the row is shown as pending
+typedef struct {
+	// alias, or path for sources
+	gchar *name;
+	// plugin data key of the listbox holding the row
+	const gchar *listbox_key;
+} HostsDeleteChange;
+
+static HostsDeleteChange *hosts_delete_change_new(const gchar *name, const gchar *listbox_key, GtkListBoxRow *row) {
+	HostsDeleteChange *change = g_new(HostsDeleteChange, 1);
+	change->name = g_strdup(name);
+	change->listbox_key = listbox_key;
+	gtk_widget_set_sensitive(GTK_WIDGET(row), FALSE);
+	return change;
+}
+
+static void hosts_delete_change_free(HostsDeleteChange *change) {
+	g_free(change->name);
+	g_free(change);
+}
+
+// Remove the row for a deleted item, or show it as no longer pending if it wasn't deleted
+static void hosts_delete_change_done(HostsPlugin *hosts, HostsDeleteChange *change, gint index, gboolean deleted) {
+	GtkWidget *listbox = g_object_get_data(G_OBJECT(hosts->plugin), change->listbox_key);
+	GtkListBoxRow *row = listbox ? gtk_list_box_get_row_at_index(GTK_LIST_BOX(listbox), index) : NULL;
+	if (!row)
+		return;
+	if (deleted)
+		gtk_container_remove(GTK_CONTAINER(listbox), GTK_WIDGET(row));
+	else
+		gtk_widget_set_sensitive(GTK_WIDGET(row), TRUE);
+}
+
+static gboolean hosts_delete_alias_apply(HostsPlugin *hosts, HostsDeleteChange *change) {
+	gint index = hosts_find(hosts, change->name);
+	if (index < 0)
+		return FALSE;
+
+	// Ensure hosts->enabled is false first
+	if (hosts_is_enabled(hosts, index)) {
+		hosts_set_enabled(hosts, index, FALSE);
+		// Sync etc/hosts; this function displays dialog on error already
+		if (!etc_hosts_sync(hosts)) {
+			hosts_set_enabled(hosts, index, TRUE);
+			hosts_delete_change_done(hosts, change, index, FALSE);
+			return FALSE;
+		}
+
+		const gchar *alias = hosts_name(hosts, index);
+		gboolean expected = FALSE;
+		hosts_propagate(hosts, &alias, &expected, 1);
+	}
+
+	// Remove from hosts, and the row from the listbox; they share indices
+	hosts_remove(hosts, index);
+	hosts_delete_change_done(hosts, change, index, TRUE);
+	return TRUE;
+}
+
 // Remove the selected host from the list
 static void hosts_delete_alias(GtkButton *button, gpointer user_data) {
 	HostsDialogData *data = (HostsDialogData *) user_data;
@@ -165,27 +232,194 @@ static void hosts_delete_alias(GtkButton *button, gpointer user_data) {
 		return;
 	}
 	gint index = gtk_list_box_row_get_index(selected_row);
+	gtk_list_box_unselect_row(GTK_LIST_BOX(data->listbox), selected_row);
 
-	// Ensure hosts->enabled is false first
-	if (data->hosts->enabled[index]) {
-		data->hosts->enabled[index] = FALSE;
+	hosts_shared_run(
+		data->hosts, (HostsSharedFunc) hosts_delete_alias_apply,
+		hosts_delete_change_new(hosts_name(data->hosts, index), "aliases-listbox", selected_row),
+		(GDestroyNotify) hosts_delete_change_free
+	);
+}
 
-		// Sync etc/hosts; this function displays dialog on error already
-		if (!etc_hosts_sync(data->hosts)) {
-			data->hosts->enabled[index] = TRUE;
+// Add a row for an external source to the sources listbox
+static void hosts_add_source_row(GtkWidget *listbox, HostsSource *source) {
+	gchar *text = g_strdup_printf("%s (%s)", source->name, source->path);
+	hosts_add_listbox_item(listbox, text, -1);
+	g_free(text);
+}
+
+static gboolean hosts_source_named(HostsPlugin *hosts, const gchar *name) {
+	for (guint i = 0; i < hosts->sources->len; i++) {
+		if (g_strcmp0(((HostsSource *) g_ptr_array_index(hosts->sources, i))->name, name) == 0)
+			return TRUE;
+	}
+	return FALSE;
+}
+
+// Pick a file or directory and add it as an external source
+static void hosts_add_source(HostsDialogData *data, GtkWidget *button, GtkFileChooserAction action) {
+	GtkWidget *chooser = gtk_file_chooser_dialog_new(
+		action == GTK_FILE_CHOOSER_ACTION_SELECT_FOLDER ? "Add Source Directory" : "Add Source File",
+		GTK_WINDOW(gtk_widget_get_toplevel(button)), action,
+		"_Cancel", GTK_RESPONSE_CANCEL,
+		"_Add", GTK_RESPONSE_ACCEPT,
+		NULL
+	);
+	if (gtk_dialog_run(GTK_DIALOG(chooser)) != GTK_RESPONSE_ACCEPT) {
+		gtk_widget_destroy(chooser);
+		return;
+	}
+	gchar *path = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(chooser));
+	gtk_widget_destroy(chooser);
+	if (path == NULL)
+		return;
+
+	// validate path is unique
+	for (guint i = 0; i < data->hosts->sources->len; i++) {
+		HostsSource *source = g_ptr_array_index(data->hosts->sources, i);
+		if (g_strcmp0(source->path, path) == 0) {
+			GtkWidget *message_dialog = gtk_message_dialog_new(
+				NULL, GTK_DIALOG_DESTROY_WITH_PARENT, GTK_MESSAGE_ERROR, GTK_BUTTONS_CLOSE,
+				"Source already added: %s", path
+			);
+			gtk_dialog_run(GTK_DIALOG(message_dialog));
+			gtk_widget_destroy(message_dialog);
+			g_free(path);
 			return;
 		}
 	}
 
-	// Remove from hosts
-	g_free(data->hosts->names[index]);
-	for (gint i = index; data->hosts->names[i]; i++) {
-		data->hosts->names[i] = data->hosts->names[i + 1];
-		data->hosts->enabled[i] = data->hosts->enabled[i + 1];
+	// new sources start disabled; they're enabled from the dropdown like hosts. Sources are tracked
+	// by path, but names are shown in the dropdown, so number any that would repeat
+	gchar *base = g_path_get_basename(path);
+	gchar *name = g_strdup(base);
+	for (guint n = 2; hosts_source_named(data->hosts, name); n++) {
+		g_free(name);
+		name = g_strdup_printf("%s (%u)", base, n);
 	}
+	g_free(base);
+	HostsSource *source = hosts_source_new(name, path);
+	g_ptr_array_add(data->hosts->sources, source);
+	hosts_add_source_row(data->sources_listbox, source);
+	g_free(name);
+	g_free(path);
+}
 
-	// Remove the row from the listbox
-	gtk_container_remove(GTK_CONTAINER(data->listbox), GTK_WIDGET(selected_row));
+static void hosts_add_source_file(GtkButton *button, gpointer user_data) {
+	hosts_add_source((HostsDialogData *) user_data, GTK_WIDGET(button), GTK_FILE_CHOOSER_ACTION_OPEN);
+}
+
+static void hosts_add_source_directory(GtkButton *button, gpointer user_data) {
+	hosts_add_source((HostsDialogData *) user_data, GTK_WIDGET(button), GTK_FILE_CHOOSER_ACTION_SELECT_FOLDER);
+}
+
+static gboolean hosts_delete_source_apply(HostsPlugin *hosts, HostsDeleteChange *change) {
+	gint index = -1;
+	for (guint i = 0; i < hosts->sources->len && index < 0; i++) {
+		if (g_strcmp0(((HostsSource *) g_ptr_array_index(hosts->sources, i))->path, change->name) == 0)
+			index = (gint) i;
+	}
+	if (index < 0)
+		return FALSE;
+	HostsSource *source = g_ptr_array_index(hosts->sources, index);
+
+	// Remove its entries from /etc/hosts first
+	if (source->enabled) {
+		source->enabled = FALSE;
+		if (!etc_hosts_sync(hosts)) {
+			source->enabled = TRUE;
+			hosts_delete_change_done(hosts, change, index, FALSE);
+			return FALSE;
+		}
+	}
+
+	g_ptr_array_remove_index(hosts->sources, index);
+	hosts_delete_change_done(hosts, change, index, TRUE);
+	return TRUE;
+}
+
+// Remove the selected external source
+static void hosts_delete_source(GtkButton *button, gpointer user_data) {
+	HostsDialogData *data = (HostsDialogData *) user_data;
+
+	// get selected row
+	GtkListBoxRow *selected_row = gtk_list_box_get_selected_row(GTK_LIST_BOX(data->sources_listbox));
+	if (!selected_row) {
+		return;
+	}
+	gint index = gtk_list_box_row_get_index(selected_row);
+	HostsSource *source = g_ptr_array_index(data->hosts->sources, index);
+	gtk_list_box_unselect_row(GTK_LIST_BOX(data->sources_listbox), selected_row);
+
+	hosts_shared_run(
+		data->hosts, (HostsSharedFunc) hosts_delete_source_apply,
+		hosts_delete_change_new(source->path, "sources-listbox", selected_row),
+		(GDestroyNotify) hosts_delete_change_free
+	);
+}
+
+// Update the cache flush command as it is edited
+static void hosts_flush_command_changed(GtkEditable *editable, gpointer user_data) {
+	HostsPlugin *hosts = (HostsPlugin *) user_data;
+	g_free(hosts->flush_command);
+	hosts->flush_command = g_strdup(gtk_entry_get_text(GTK_ENTRY(editable)));
+}
+
+// Why an extra target can't be written, or NULL if it can. These are the same rules the commit
+// helper enforces as root; checking them here keeps a bad path from ever reaching it
+static const gchar *hosts_target_invalid(const gchar *path) {
+	static const gchar * const system_dirs[] = {"/etc/", "/proc/", "/sys/", "/dev/", "/boot/", "/usr/", "/root/", "/run/", NULL};
+	if (!g_path_is_absolute(path) || strchr(path, '\n'))
+		return "not an absolute path";
+	gchar *base = g_path_get_basename(path);
+	gboolean named_hosts = g_strcmp0(base, "hosts") == 0;
+	g_free(base);
+	if (!named_hosts)
+		return "not a file named hosts";
+	if (strstr(path, "/./") || strstr(path, "/../") || g_str_has_suffix(path, "/.") || g_str_has_suffix(path, "/.."))
+		return "contains . or .. components";
+	for (guint i = 0; system_dirs[i]; i++) {
+		if (g_str_has_prefix(path, system_dirs[i]))
+			return "in a system directory";
+	}
+	if (g_file_test(path, G_FILE_TEST_IS_SYMLINK) || !g_file_test(path, G_FILE_TEST_IS_REGULAR))
+		return "not an existing regular file";
+	char *resolved = realpath(path, NULL);
+	gboolean direct = resolved && strcmp(resolved, path) == 0;
+	free(resolved);
+	if (!direct)
+		return "goes through a symlink";
+	return NULL;
+}
+
+// Update the additional sync targets as they are edited; paths are separated by semicolons. Keep
+// only the targets that can be written, and flag the rest on the entry
+static void hosts_targets_changed(GtkEditable *editable, gpointer user_data) {
+	HostsPlugin *hosts = (HostsPlugin *) user_data;
+	gchar **paths = g_strsplit(gtk_entry_get_text(GTK_ENTRY(editable)), ";", -1);
+	GPtrArray *targets = g_ptr_array_new();
+	GString *invalid = g_string_new(NULL);
+	for (guint i = 0; paths[i]; i++) {
+		gchar *path = g_strstrip(paths[i]);
+		if (!*path)
+			continue;
+		const gchar *reason = hosts_target_invalid(path);
+		if (reason)
+			g_string_append_printf(invalid, "%s%s: %s", invalid->len ? "\n" : "", path, reason);
+		else
+			g_ptr_array_add(targets, g_strdup(path));
+	}
+	g_ptr_array_add(targets, NULL);
+	g_strfreev(paths);
+	g_strfreev(hosts->targets);
+	hosts->targets = (gchar **) g_ptr_array_free(targets, FALSE);
+
+	gtk_entry_set_icon_from_icon_name(GTK_ENTRY(editable), GTK_ENTRY_ICON_SECONDARY, invalid->len ? "dialog-warning" : NULL);
+	if (invalid->len) {
+		g_string_prepend(invalid, "Ignored:\n");
+		gtk_entry_set_icon_tooltip_text(GTK_ENTRY(editable), GTK_ENTRY_ICON_SECONDARY, invalid->str);
+	}
+	g_string_free(invalid, TRUE);
 }
 
 // Shift an alias in the list up or down some number of positions
@@ -203,16 +437,11 @@ static void hosts_shift_alias_generic(HostsDialogData *data, gint shift){
 	}
 
 	// Swap the rows
-	gchar *temp_name = data->hosts->names[new_index];
-	data->hosts->names[new_index] = data->hosts->names[cur_index];
-	data->hosts->names[cur_index] = temp_name;
-	gboolean temp_enabled = data->hosts->enabled[new_index];
-	data->hosts->enabled[new_index] = data->hosts->enabled[cur_index];
-	data->hosts->enabled[cur_index] = temp_enabled;
+	hosts_swap(data->hosts, cur_index, new_index);
 
 	// Remove the list item and then reinsert at the new position
 	gtk_container_remove(GTK_CONTAINER(data->listbox), GTK_WIDGET(selected_row));
-	GtkWidget *row = hosts_add_listbox_item(data->listbox, data->hosts->names[new_index], new_index);
+	GtkWidget *row = hosts_add_alias_item(data->hosts, data->listbox, new_index, new_index);
 	gtk_list_box_select_row(GTK_LIST_BOX(data->listbox), GTK_LIST_BOX_ROW(row));
 }
 
@@ -255,10 +484,10 @@ void hosts_configure (XfcePanelPlugin *plugin, HostsPlugin *hosts){
 	gtk_container_add(GTK_CONTAINER(scroll), data->listbox);
 	gtk_box_pack_start(GTK_BOX(hbox), scroll, TRUE, TRUE, 0);
 
-	// Initialize listbox with all elements in hosts->names
-	if (hosts->names != NULL) {
-		for (gint i = 0; hosts->names[i]; i++)
-			hosts_add_listbox_item(data->listbox, hosts->names[i], -1);
+	// Initialize listbox with all configured hosts
+	if (hosts->n_names) {
+		for (guint i = 0; i < hosts->n_names; i++)
+			hosts_add_alias_item(hosts, data->listbox, i, -1);
 	}
 
 	// Create the button box
@@ -318,6 +547,83 @@ void hosts_configure (XfcePanelPlugin *plugin, HostsPlugin *hosts){
 	g_signal_connect(button_add, "clicked", G_CALLBACK(hosts_add_alias), data);
 	g_signal_connect(data->entry, "activate", G_CALLBACK(hosts_add_alias), data);
 
+	// External sources: hosts-format files or directories, toggled from the dropdown
+	GtkWidget *sources_label = gtk_label_new("External sources (hosts files or directories):");
+	gtk_widget_set_halign(sources_label, GTK_ALIGN_START);
+	gtk_box_pack_start(GTK_BOX(vbox), sources_label, FALSE, FALSE, 0);
+
+	GtkWidget *sources_hbox = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 5);
+	GtkWidget *sources_scroll = gtk_scrolled_window_new(NULL, NULL);
+	gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(sources_scroll), GTK_POLICY_AUTOMATIC, GTK_POLICY_AUTOMATIC);
+	gtk_widget_set_size_request(sources_scroll, -1, 100);
+	data->sources_listbox = gtk_list_box_new();
+	gtk_container_add(GTK_CONTAINER(sources_scroll), data->sources_listbox);
+	gtk_box_pack_start(GTK_BOX(sources_hbox), sources_scroll, TRUE, TRUE, 0);
+	for (guint i = 0; i < hosts->sources->len; i++)
+		hosts_add_source_row(data->sources_listbox, g_ptr_array_index(hosts->sources, i));
+
+	GtkWidget *sources_button_box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 5);
+	GtkWidget *button_add_file = gtk_button_new();
+	if (gtk_icon_theme_has_icon(theme, "document-open-symbolic")) {
+		gtk_button_set_image(GTK_BUTTON(button_add_file), gtk_image_new_from_icon_name("document-open-symbolic", GTK_ICON_SIZE_BUTTON));
+	} else {
+		gtk_button_set_label(GTK_BUTTON(button_add_file), "Add File");
+	}
+	gtk_widget_set_tooltip_text(button_add_file, "Add a hosts file as a source");
+	g_signal_connect(button_add_file, "clicked", G_CALLBACK(hosts_add_source_file), data);
+
+	GtkWidget *button_add_directory = gtk_button_new();
+	if (gtk_icon_theme_has_icon(theme, "folder-open-symbolic")) {
+		gtk_button_set_image(GTK_BUTTON(button_add_directory), gtk_image_new_from_icon_name("folder-open-symbolic", GTK_ICON_SIZE_BUTTON));
+	} else {
+		gtk_button_set_label(GTK_BUTTON(button_add_directory), "Add Directory");
+	}
+	gtk_widget_set_tooltip_text(button_add_directory, "Add a directory of hosts files as a source");
+	g_signal_connect(button_add_directory, "clicked", G_CALLBACK(hosts_add_source_directory), data);
+
+	GtkWidget *button_delete_source = gtk_button_new();
+	if (gtk_icon_theme_has_icon(theme, "user-trash-symbolic")) {
+		gtk_button_set_image(GTK_BUTTON(button_delete_source), gtk_image_new_from_icon_name("user-trash-symbolic", GTK_ICON_SIZE_BUTTON));
+	} else {
+		gtk_button_set_label(GTK_BUTTON(button_delete_source), "Delete");
+	}
+	gtk_widget_set_tooltip_text(button_delete_source, "Delete selected source");
+	g_signal_connect(button_delete_source, "clicked", G_CALLBACK(hosts_delete_source), data);
+
+	gtk_box_pack_start(GTK_BOX(sources_button_box), button_add_file, FALSE, FALSE, 0);
+	gtk_box_pack_start(GTK_BOX(sources_button_box), button_add_directory, FALSE, FALSE, 0);
+	gtk_box_pack_start(GTK_BOX(sources_button_box), button_delete_source, FALSE, FALSE, 0);
+	gtk_box_pack_start(GTK_BOX(sources_hbox), sources_button_box, FALSE, FALSE, 0);
+	gtk_box_pack_start(GTK_BOX(vbox), sources_hbox, FALSE, FALSE, 0);
+
+	// Command to flush resolver caches after each write; empty to disable
+	GtkWidget *flush_hbox = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 5);
+	GtkWidget *flush_label = gtk_label_new("Cache flush command:");
+	GtkWidget *flush_entry = gtk_entry_new();
+	gtk_entry_set_text(GTK_ENTRY(flush_entry), hosts->flush_command ? hosts->flush_command : "");
+	gtk_entry_set_placeholder_text(GTK_ENTRY(flush_entry), "None");
+	gtk_widget_set_tooltip_text(flush_entry, "Run after each /etc/hosts write, e.g. resolvectl flush-caches");
+	gtk_box_pack_start(GTK_BOX(flush_hbox), flush_label, FALSE, FALSE, 0);
+	gtk_box_pack_start(GTK_BOX(flush_hbox), flush_entry, TRUE, TRUE, 0);
+	gtk_box_pack_start(GTK_BOX(vbox), flush_hbox, FALSE, FALSE, 0);
+	g_signal_connect(flush_entry, "changed", G_CALLBACK(hosts_flush_command_changed), hosts);
+
+	// Other hosts files to keep in sync, e.g. bind-mounted into containers
+	GtkWidget *targets_hbox = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 5);
+	GtkWidget *targets_label = gtk_label_new("Also sync to:");
+	GtkWidget *targets_entry = gtk_entry_new();
+	if (hosts->targets) {
+		gchar *targets = g_strjoinv("; ", hosts->targets);
+		gtk_entry_set_text(GTK_ENTRY(targets_entry), targets);
+		g_free(targets);
+	}
+	gtk_entry_set_placeholder_text(GTK_ENTRY(targets_entry), "/path/to/container/hosts; ...");
+	gtk_widget_set_tooltip_text(targets_entry, "Semicolon separated absolute paths of files named hosts");
+	gtk_box_pack_start(GTK_BOX(targets_hbox), targets_label, FALSE, FALSE, 0);
+	gtk_box_pack_start(GTK_BOX(targets_hbox), targets_entry, TRUE, TRUE, 0);
+	gtk_box_pack_start(GTK_BOX(vbox), targets_hbox, FALSE, FALSE, 0);
+	g_signal_connect(targets_entry, "changed", G_CALLBACK(hosts_targets_changed), hosts);
+
 	// Show all the widgets in the vbox
 	gtk_widget_show_all(vbox);
 
@@ -348,6 +654,9 @@ void hosts_configure (XfcePanelPlugin *plugin, HostsPlugin *hosts){
 	// link the dialog to the plugin, so we can destroy it when the plugin
 	// is closed, but the dialog is still open
 	g_object_set_data(G_OBJECT(plugin), "dialog", dialog);
+	// deletions waiting for the write lock remove their rows through these
+	g_object_set_data(G_OBJECT(plugin), "aliases-listbox", data->listbox);
+	g_object_set_data(G_OBJECT(plugin), "sources-listbox", data->sources_listbox);
 
 	// connect the response signal to the dialog
 	g_signal_connect(G_OBJECT(dialog), "response", G_CALLBACK(hosts_configure_response), hosts);
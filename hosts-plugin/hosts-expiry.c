@@ -0,0 +1,294 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <gtk/gtk.h>
+#include <libxfce4util/libxfce4util.h>
+#include <libxfce4panel/libxfce4panel.h>
+
+#include "hosts.h"
+#include "hosts-expiry.h"
+#include "hosts-propagate.h"
+#include "hosts-shared.h"
+#include "hosts-state.h"
+
+// Timed aliases are tracked by a hashed timer wheel driven by a single GSource. Each slot covers
+// EXPIRY_TICK seconds; an alias goes in the slot of the first tick at or after its expiry, and
+// stays there for extra rounds if it expires more than a full turn of the wheel away. Everything
+// due in a tick is disabled together with one sync, so one privileged write per window at most.
+// Rescheduling doesn't search the wheel: stale entries are dropped when their slot comes up.
+// An alias keeps its expiry time until it has actually been disabled; if the write fails (e.g. the
+// password prompt was dismissed), it is retried with a growing delay rather than forgotten.
+
+#define EXPIRY_TICK 30
+#define EXPIRY_SLOTS 64
+// Longest delay between retries of a failed write, in ticks; less than a turn of the wheel
+#define EXPIRY_RETRY_MAX 32
+
+// Durations offered in the "Enable for" menu, in minutes
+static const guint expiry_durations[] = { 15, 30, 60, 240 };
+
+typedef struct {
+	gchar *alias;
+	gint64 expires;
+} ExpiryEntry;
+
+struct _HostsExpiryWheel {
+	GSList *slots[EXPIRY_SLOTS];
+	// last tick processed; ticks are seconds since the epoch / EXPIRY_TICK
+	gint64 last_tick;
+	// number of entries in all slots
+	guint count;
+	guint source_id;
+	// ticks to wait before retrying a failed write; 0 after a successful one
+	guint retry_ticks;
+};
+
+static void expiry_entry_free(ExpiryEntry *entry) {
+	g_free(entry->alias);
+	g_free(entry);
+}
+
+static gboolean expiry_tick(HostsPlugin *hosts);
+
+// Put an alias's expiry in the slot for tick, which may be later than the expiry itself
+static void expiry_schedule(HostsPlugin *hosts, guint index, gint64 tick) {
+	HostsExpiryWheel *wheel = hosts->expiry;
+	ExpiryEntry *entry = g_new(ExpiryEntry, 1);
+	entry->alias = g_strdup(hosts_name(hosts, index));
+	entry->expires = hosts->expires[index];
+	wheel->slots[tick % EXPIRY_SLOTS] = g_slist_prepend(wheel->slots[tick % EXPIRY_SLOTS], entry);
+	wheel->count++;
+
+	if (!wheel->source_id)
+		wheel->source_id = g_timeout_add_seconds(EXPIRY_TICK, (GSourceFunc) expiry_tick, hosts);
+}
+
+// Disable a batch of expired aliases with a single sync, once the write lock is free. The entries
+// are the expiry times that came due, so a time changed meanwhile (or cleared by toggling the
+// alias by hand) is left alone
+static gboolean expiry_disable(HostsPlugin *hosts, GPtrArray *due) {
+	HostsExpiryWheel *wheel = hosts->expiry;
+	GArray *indices = g_array_new(FALSE, FALSE, sizeof(guint));
+	for (guint k = 0; k < due->len; k++) {
+		ExpiryEntry *entry = g_ptr_array_index(due, k);
+		gint i = hosts_find(hosts, entry->alias);
+		if (i < 0 || hosts->expires[i] != entry->expires)
+			continue;
+		guint index = (guint) i;
+		// already disabled some other way; nothing left to do
+		if (!hosts_is_enabled(hosts, index)) {
+			hosts->expires[index] = 0;
+			continue;
+		}
+		g_array_append_val(indices, index);
+	}
+	const gchar **aliases = g_new(const gchar *, MAX(indices->len, 1));
+	gboolean *expected = g_new0(gboolean, MAX(indices->len, 1));
+	for (guint k = 0; k < indices->len; k++) {
+		guint i = g_array_index(indices, guint, k);
+		DBG("Host %s expired", hosts_name(hosts, i));
+		hosts_set_enabled(hosts, i, FALSE);
+		aliases[k] = hosts_name(hosts, i);
+	}
+	// this runs unattended; only the first failure in a row shows the error
+	hosts->sync_quiet = wheel->retry_ticks > 0;
+	gboolean success = indices->len && etc_hosts_sync(hosts);
+	hosts->sync_quiet = FALSE;
+	if (success) {
+		for (guint k = 0; k < indices->len; k++)
+			hosts->expires[g_array_index(indices, guint, k)] = 0;
+		wheel->retry_ticks = 0;
+		hosts_propagate(hosts, aliases, expected, indices->len);
+	}
+	else if (indices->len) {
+		// keep them enabled and their expiry pending, and try again later, backing off so a
+		// dismissed password prompt doesn't come straight back
+		wheel->retry_ticks = wheel->retry_ticks ? MIN(wheel->retry_ticks * 2, EXPIRY_RETRY_MAX) : 1;
+		for (guint k = 0; k < indices->len; k++) {
+			guint i = g_array_index(indices, guint, k);
+			hosts_set_enabled(hosts, i, TRUE);
+			expiry_schedule(hosts, i, wheel->last_tick + wheel->retry_ticks);
+		}
+		g_message("Failed to disable %u expired hosts; retrying in %u s", indices->len, wheel->retry_ticks * EXPIRY_TICK);
+	}
+	g_free(aliases);
+	g_free(expected);
+	g_array_free(indices, TRUE);
+
+	// persist the cleared expiry times
+	hosts_save(hosts->plugin, hosts);
+	return success;
+}
+
+static gboolean expiry_tick(HostsPlugin *hosts) {
+	HostsExpiryWheel *wheel = hosts->expiry;
+	gint64 now = g_get_real_time() / G_USEC_PER_SEC;
+	gint64 tick = now / EXPIRY_TICK;
+	GPtrArray *expired = g_ptr_array_new_with_free_func((GDestroyNotify) expiry_entry_free);
+
+	// after a long suspend every slot may be due, but each only needs visiting once
+	for (gint64 t = MAX(wheel->last_tick + 1, tick - EXPIRY_SLOTS + 1); t <= tick; t++) {
+		GSList *keep = NULL;
+		GSList **slot = &wheel->slots[t % EXPIRY_SLOTS];
+		for (GSList *l = *slot; l; l = l->next) {
+			ExpiryEntry *entry = (ExpiryEntry *) l->data;
+			// not due until a later turn of the wheel
+			if (entry->expires > now) {
+				keep = g_slist_prepend(keep, entry);
+				continue;
+			}
+			// alias was removed, or its expiry changed since this entry was scheduled; the expiry
+			// itself is only cleared once the alias is disabled
+			gint i = hosts_find(hosts, entry->alias);
+			if (i >= 0 && hosts->expires[i] == entry->expires)
+				g_ptr_array_add(expired, entry);
+			else
+				expiry_entry_free(entry);
+			wheel->count--;
+		}
+		g_slist_free(*slot);
+		*slot = keep;
+	}
+	wheel->last_tick = tick;
+
+	if (expired->len)
+		hosts_shared_run(hosts, (HostsSharedFunc) expiry_disable, expired, (GDestroyNotify) g_ptr_array_unref);
+	else
+		g_ptr_array_unref(expired);
+
+	if (wheel->count)
+		return G_SOURCE_CONTINUE;
+	wheel->source_id = 0;
+	return G_SOURCE_REMOVE;
+}
+
+void hosts_expiry_set(HostsPlugin *hosts, guint index, gint64 expires) {
+	HostsExpiryWheel *wheel = hosts->expiry;
+	hosts->expires[index] = expires;
+	if (!expires)
+		return;
+
+	// first tick at or after expiry, but never one that was already processed
+	expiry_schedule(hosts, index, MAX((expires + EXPIRY_TICK - 1) / EXPIRY_TICK, wheel->last_tick + 1));
+}
+
+gboolean hosts_expiry_pending(HostsPlugin *hosts, guint index) {
+	return hosts->expires[index] && hosts->expires[index] <= g_get_real_time() / G_USEC_PER_SEC;
+}
+
+void hosts_expiry_init(HostsPlugin *hosts) {
+	hosts->expiry = g_new0(HostsExpiryWheel, 1);
+	hosts->expiry->last_tick = g_get_real_time() / G_USEC_PER_SEC / EXPIRY_TICK - 1;
+	for (guint i = 0; i < hosts->n_names; i++) {
+		if (hosts->expires[i])
+			hosts_expiry_set(hosts, i, hosts->expires[i]);
+	}
+}
+
+void hosts_expiry_free(HostsPlugin *hosts) {
+	HostsExpiryWheel *wheel = hosts->expiry;
+	if (wheel->source_id)
+		g_source_remove(wheel->source_id);
+	for (guint s = 0; s < EXPIRY_SLOTS; s++)
+		g_slist_free_full(wheel->slots[s], (GDestroyNotify) expiry_entry_free);
+	g_free(wheel);
+	hosts->expiry = NULL;
+}
+
+// An alias being enabled for a while, by name, once the write lock is free
+typedef struct {
+	gchar *alias;
+	// seconds since the epoch, fixed when chosen from the menu
+	gint64 expires;
+} ExpiryChange;
+
+static void expiry_change_free(ExpiryChange *change) {
+	g_free(change->alias);
+	g_free(change);
+}
+
+static gboolean expiry_enable_apply(HostsPlugin *hosts, ExpiryChange *change) {
+	gint i = hosts_find(hosts, change->alias);
+	// removed while waiting for the lock
+	if (i < 0)
+		return FALSE;
+	guint index = (guint) i;
+	gboolean previous = hosts_is_enabled(hosts, index);
+	hosts_set_enabled(hosts, index, TRUE);
+	if (!etc_hosts_sync(hosts)) {
+		hosts_set_enabled(hosts, index, previous);
+		return FALSE;
+	}
+
+	hosts_expiry_set(hosts, index, change->expires);
+	hosts_save(hosts->plugin, hosts);
+	if (!previous) {
+		const gchar *alias = hosts_name(hosts, index);
+		gboolean expected = TRUE;
+		hosts_propagate(hosts, &alias, &expected, 1);
+	}
+	return TRUE;
+}
+
+// Enable an alias from the "Enable for" menu, scheduling it to be disabled later
+static void expiry_enable_for(GtkMenuItem *item, HostsPlugin *hosts) {
+	guint index = GPOINTER_TO_UINT(g_object_get_data(G_OBJECT(item), "index"));
+	guint minutes = GPOINTER_TO_UINT(g_object_get_data(G_OBJECT(item), "minutes"));
+
+	ExpiryChange *change = g_new(ExpiryChange, 1);
+	change->alias = g_strdup(hosts_name(hosts, index));
+	change->expires = g_get_real_time() / G_USEC_PER_SEC + minutes * 60;
+	hosts_shared_run(hosts, (HostsSharedFunc) expiry_enable_apply, change, (GDestroyNotify) expiry_change_free);
+}
+
+// Fill an alias's durations submenu the first time it is opened
+static void expiry_alias_select(GtkMenuItem *alias_item, HostsPlugin *hosts) {
+	if (g_object_get_data(G_OBJECT(alias_item), "filled"))
+		return;
+	g_object_set_data(G_OBJECT(alias_item), "filled", GINT_TO_POINTER(TRUE));
+	GtkWidget *durations = gtk_menu_item_get_submenu(alias_item);
+	gpointer index = g_object_get_data(G_OBJECT(alias_item), "index");
+	for (guint d = 0; d < G_N_ELEMENTS(expiry_durations); d++) {
+		guint minutes = expiry_durations[d];
+		gchar *label;
+		if (minutes < 60)
+			label = g_strdup_printf("%u minutes", minutes);
+		else if (minutes == 60)
+			label = g_strdup("1 hour");
+		else
+			label = g_strdup_printf("%u hours", minutes / 60);
+		GtkWidget *item = gtk_menu_item_new_with_label(label);
+		g_free(label);
+		g_object_set_data(G_OBJECT(item), "index", index);
+		g_object_set_data(G_OBJECT(item), "minutes", GUINT_TO_POINTER(minutes));
+		g_signal_connect(item, "activate", G_CALLBACK(expiry_enable_for), hosts);
+		gtk_menu_shell_append(GTK_MENU_SHELL(durations), item);
+	}
+	gtk_widget_show_all(durations);
+}
+
+// Fill the alias submenu the first time it is opened; each alias's durations wait for that alias
+static void expiry_menu_select(GtkMenuItem *enable_for, HostsPlugin *hosts) {
+	if (g_object_get_data(G_OBJECT(enable_for), "filled"))
+		return;
+	g_object_set_data(G_OBJECT(enable_for), "filled", GINT_TO_POINTER(TRUE));
+	GtkWidget *aliases = gtk_menu_item_get_submenu(enable_for);
+	for (guint i = 0; i < hosts->n_names; i++) {
+		GtkWidget *item = gtk_menu_item_new_with_label(hosts_name(hosts, i));
+		g_object_set_data(G_OBJECT(item), "index", GUINT_TO_POINTER(i));
+		gtk_menu_item_set_submenu(GTK_MENU_ITEM(item), gtk_menu_new());
+		g_signal_connect(item, "select", G_CALLBACK(expiry_alias_select), hosts);
+		gtk_menu_shell_append(GTK_MENU_SHELL(aliases), item);
+	}
+	gtk_widget_show_all(aliases);
+}
+
+void hosts_expiry_menu(HostsPlugin *hosts, GtkWidget *menu) {
+	// submenus are built when opened, so a dropdown with thousands of hosts doesn't build them all
+	GtkWidget *enable_for = gtk_menu_item_new_with_label("Enable for");
+	gtk_menu_item_set_submenu(GTK_MENU_ITEM(enable_for), gtk_menu_new());
+	g_signal_connect(enable_for, "select", G_CALLBACK(expiry_menu_select), hosts);
+	gtk_widget_set_sensitive(enable_for, hosts->n_names > 0);
+	gtk_menu_shell_append(GTK_MENU_SHELL(menu), enable_for);
+}
@@ -0,0 +1,23 @@
+#ifndef __HOSTS_EXPIRY_H__
+#define __HOSTS_EXPIRY_H__
+
+G_BEGIN_DECLS
+
+// Start the expiry timer for any aliases read with an expiry time
+void hosts_expiry_init(HostsPlugin *hosts);
+
+// Stop the expiry timer and free the timer wheel
+void hosts_expiry_free(HostsPlugin *hosts);
+
+// Set when an alias should be disabled (seconds since the epoch); 0 to keep it indefinitely
+void hosts_expiry_set(HostsPlugin *hosts, guint index, gint64 expires);
+
+// Check if an alias's expiry time has passed but it couldn't be disabled yet
+gboolean hosts_expiry_pending(HostsPlugin *hosts, guint index);
+
+// Append the "Enable for" submenu to the dropdown menu
+void hosts_expiry_menu(HostsPlugin *hosts, GtkWidget *menu);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,453 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include <gtk/gtk.h>
+#include <libxfce4util/libxfce4util.h>
+#include <libxfce4panel/libxfce4panel.h>
+
+#include "hosts.h"
+#include "hosts-history.h"
+#include "hosts-propagate.h"
+#include "hosts-shared.h"
+#include "hosts-sources.h"
+#include "hosts-state.h"
+
+// History of the plugin's writes to /etc/hosts, kept as one line per write:
+//   <time> <base checksum> <result checksum> [+|-]<line>:<alias> ...
+// Only the aliases changed on the managed 127.0.0.1 line, and the external sources enabled or
+// disabled (as "source:<escaped name>"), are stored, never file contents, so storage and restore
+// time depend on the number of changes rather than the size of /etc/hosts.
+// The file is shared by all instances and only modified while holding the shared write lock.
+
+// Once the history grows past this size, the oldest half is dropped
+#define HISTORY_MAX_BYTES (256 * 1024)
+// Number of entries to offer in the "Restore to" menu
+#define HISTORY_MENU_ENTRIES 15
+
+typedef struct {
+	// microseconds since the epoch
+	gint64 time;
+	gchar *base;
+	gchar *result;
+	GArray *deltas;
+} HistoryEntry;
+
+static void hosts_delta_clear(HostsDelta *delta) {
+	g_free(delta->alias);
+}
+
+GArray *hosts_delta_array_new(void) {
+	GArray *deltas = g_array_new(FALSE, FALSE, sizeof(HostsDelta));
+	g_array_set_clear_func(deltas, (GDestroyNotify) hosts_delta_clear);
+	return deltas;
+}
+
+void hosts_delta_append(GArray *deltas, gboolean added, guint line, const gchar *alias) {
+	HostsDelta delta = { added, line, g_strdup(alias) };
+	g_array_append_val(deltas, delta);
+}
+
+static void history_entry_free(HistoryEntry *entry) {
+	g_free(entry->base);
+	g_free(entry->result);
+	g_array_unref(entry->deltas);
+	g_free(entry);
+}
+
+static gchar *history_path(void) {
+	gchar *dir = g_build_filename(g_get_user_data_dir(), "xfce4-hosts-plugin", NULL);
+	g_mkdir_with_parents(dir, 0700);
+	gchar *path = g_build_filename(dir, "history", NULL);
+	g_free(dir);
+	return path;
+}
+
+static void history_format(GString *out, gint64 time, const gchar *base, const gchar *result, GArray *deltas) {
+	g_string_append_printf(out, "%" G_GINT64_FORMAT " %s %s", time, base, result);
+	for (guint i = 0; i < deltas->len; i++) {
+		HostsDelta *delta = &g_array_index(deltas, HostsDelta, i);
+		g_string_append_printf(out, " %c%u:%s", delta->added ? '+' : '-', delta->line, delta->alias);
+	}
+	g_string_append_c(out, '\n');
+}
+
+// Load all entries, oldest first
+static GPtrArray *history_load(void) {
+	GPtrArray *entries = g_ptr_array_new_with_free_func((GDestroyNotify) history_entry_free);
+	gchar *path = history_path();
+	gchar *contents = NULL;
+	gboolean found = g_file_get_contents(path, &contents, NULL, NULL);
+	g_free(path);
+	if (!found)
+		return entries;
+
+	gchar **lines = g_strsplit(contents, "\n", -1);
+	g_free(contents);
+	for (guint i = 0; lines[i]; i++) {
+		gchar **tokens = g_strsplit(lines[i], " ", -1);
+		if (g_strv_length(tokens) < 3) {
+			g_strfreev(tokens);
+			continue;
+		}
+		HistoryEntry *entry = g_new0(HistoryEntry, 1);
+		entry->time = g_ascii_strtoll(tokens[0], NULL, 10);
+		entry->base = g_strdup(tokens[1]);
+		entry->result = g_strdup(tokens[2]);
+		entry->deltas = hosts_delta_array_new();
+		for (guint k = 3; tokens[k]; k++) {
+			gchar *sep = strchr(tokens[k], ':');
+			if ((tokens[k][0] != '+' && tokens[k][0] != '-') || !sep)
+				continue;
+			guint line = (guint) g_ascii_strtoull(tokens[k] + 1, NULL, 10);
+			hosts_delta_append(entry->deltas, tokens[k][0] == '+', line, sep + 1);
+		}
+		g_ptr_array_add(entries, entry);
+		g_strfreev(tokens);
+	}
+	g_strfreev(lines);
+	return entries;
+}
+
+// Rewrite the history file with entries [start, end)
+static gboolean history_save(GPtrArray *entries, guint start, guint end) {
+	GString *out = g_string_new(NULL);
+	for (guint i = start; i < end; i++) {
+		HistoryEntry *entry = g_ptr_array_index(entries, i);
+		history_format(out, entry->time, entry->base, entry->result, entry->deltas);
+	}
+	gchar *path = history_path();
+	GError *error = NULL;
+	gboolean success = g_file_set_contents(path, out->str, out->len, &error);
+	if (!success) {
+		g_warning("Failed to save /etc/hosts history: %s", error->message);
+		g_error_free(error);
+	}
+	g_free(path);
+	g_string_free(out, TRUE);
+	return success;
+}
+
+void hosts_history_record(const gchar *base, const gchar *result, GArray *deltas) {
+	GString *line = g_string_new(NULL);
+	history_format(line, g_get_real_time(), base, result, deltas);
+
+	// append only the new entry, so recording doesn't depend on the history length
+	gchar *path = history_path();
+	GFile *file = g_file_new_for_path(path);
+	g_free(path);
+	GError *error = NULL;
+	goffset size = 0;
+	GFileOutputStream *stream = g_file_append_to(file, G_FILE_CREATE_PRIVATE, NULL, &error);
+	if (stream) {
+		if (g_output_stream_write_all(G_OUTPUT_STREAM(stream), line->str, line->len, NULL, NULL, &error))
+			size = g_seekable_tell(G_SEEKABLE(stream));
+		g_output_stream_close(G_OUTPUT_STREAM(stream), NULL, NULL);
+		g_object_unref(stream);
+	}
+	g_object_unref(file);
+	g_string_free(line, TRUE);
+	if (error) {
+		g_warning("Failed to record /etc/hosts history: %s", error->message);
+		g_error_free(error);
+		return;
+	}
+
+	// keep the history bounded; trimming half at a time keeps this amortized O(1) per write
+	if (size > HISTORY_MAX_BYTES) {
+		GPtrArray *entries = history_load();
+		history_save(entries, entries->len / 2, entries->len);
+		g_ptr_array_unref(entries);
+	}
+}
+
+// Set of the delta names this instance can revert: its aliases and sources
+static GHashTable *history_owned_new(HostsPlugin *hosts) {
+	GHashTable *owned = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	for (guint i = 0; i < hosts->n_names; i++)
+		g_hash_table_add(owned, g_strdup(hosts_name(hosts, i)));
+	for (guint i = 0; i < hosts->sources->len; i++)
+		g_hash_table_add(owned, hosts_source_delta_name(((HostsSource *) g_ptr_array_index(hosts->sources, i))->path));
+	return owned;
+}
+
+// Check if any of entries [start, end) has a delta in the owned set
+static gboolean history_has_owned(GPtrArray *entries, guint start, guint end, GHashTable *owned) {
+	for (guint i = start; i < end; i++) {
+		HistoryEntry *entry = g_ptr_array_index(entries, i);
+		for (guint k = 0; k < entry->deltas->len; k++) {
+			if (g_hash_table_contains(owned, g_array_index(entry->deltas, HostsDelta, k).alias))
+				return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+// Drop deltas for aliases and sources that no instance has configured anymore, since nothing
+// can revert them, and entries left empty. Returns true if anything was dropped
+static gboolean history_prune(HostsPlugin *hosts, GPtrArray *entries) {
+	GHashTable *configured = hosts_shared_configured(hosts);
+	gboolean pruned = FALSE;
+	for (guint i = entries->len; i-- > 0;) {
+		HistoryEntry *entry = g_ptr_array_index(entries, i);
+		for (guint k = entry->deltas->len; k-- > 0;) {
+			if (!g_hash_table_contains(configured, g_array_index(entry->deltas, HostsDelta, k).alias)) {
+				g_array_remove_index(entry->deltas, k);
+				pruned = TRUE;
+			}
+		}
+		if (!entry->deltas->len)
+			g_ptr_array_remove_index(entries, i);
+	}
+	g_hash_table_destroy(configured);
+	return pruned;
+}
+
+// Index of the newest entry with a delta this instance can revert, or -1 if there is none. Newer
+// entries may only have changes from other instances, which their own undo takes care of
+static gint history_undo_index(HostsPlugin *hosts, GPtrArray *entries) {
+	GHashTable *owned = history_owned_new(hosts);
+	gint index = (gint) entries->len - 1;
+	while (index >= 0 && !history_has_owned(entries, index, index + 1, owned))
+		index--;
+	g_hash_table_destroy(owned);
+	return index;
+}
+
+// Revert entries [start, end) with a single sync, then drop them from the history. Changes to
+// aliases or sources this instance doesn't have can't be reverted here; those deltas are kept,
+// so the instance that made them can still undo them, and the user is told.
+// Caller holds the shared write lock, and has pruned the entries.
+static gboolean history_revert(HostsPlugin *hosts, GPtrArray *entries, guint start, guint end) {
+	// don't write anything if none of the changes are ours
+	GHashTable *owned = history_owned_new(hosts);
+	gboolean any = history_has_owned(entries, start, end, owned);
+	g_hash_table_destroy(owned);
+	if (!any)
+		return FALSE;
+
+	// the deltas still apply if /etc/hosts was edited by hand since, but let the user know
+	HistoryEntry *last = g_ptr_array_index(entries, entries->len - 1);
+	gchar *contents = NULL;
+	gsize length;
+	if (g_file_get_contents("/etc/hosts", &contents, &length, NULL)) {
+		gchar *current = g_compute_checksum_for_data(G_CHECKSUM_SHA256, (const guchar *) contents, length);
+		if (g_strcmp0(current, last->result) != 0)
+			g_message("/etc/hosts was modified outside the plugin since the last recorded change");
+		g_free(current);
+		g_free(contents);
+	}
+
+	// Walk newest to oldest; the oldest entry touching an alias determines its final state
+	GHashTable *target = g_hash_table_new(g_str_hash, g_str_equal);
+	for (guint i = end; i-- > start;) {
+		HistoryEntry *entry = g_ptr_array_index(entries, i);
+		for (guint k = 0; k < entry->deltas->len; k++) {
+			HostsDelta *delta = &g_array_index(entry->deltas, HostsDelta, k);
+			g_hash_table_insert(target, delta->alias, GINT_TO_POINTER(!delta->added));
+		}
+	}
+
+	// Apply to our flags, remembering the old values in case the write fails. Whatever is left
+	// in target afterwards isn't configured in this instance
+	guint count = hosts->n_names;
+	gboolean *previous = g_new(gboolean, count);
+	GPtrArray *changed = g_ptr_array_new();
+	GArray *expected = g_array_new(FALSE, FALSE, sizeof(gboolean));
+	for (guint i = 0; i < count; i++) {
+		const gchar *name = hosts_name(hosts, i);
+		previous[i] = hosts_is_enabled(hosts, i);
+		gpointer value;
+		if (!g_hash_table_lookup_extended(target, name, NULL, &value))
+			continue;
+		g_hash_table_remove(target, name);
+		gboolean enabled = GPOINTER_TO_INT(value);
+		if (enabled != previous[i]) {
+			hosts_set_enabled(hosts, i, enabled);
+			g_ptr_array_add(changed, (gpointer) name);
+			g_array_append_val(expected, enabled);
+		}
+	}
+	gboolean *source_previous = g_new(gboolean, MAX(hosts->sources->len, 1));
+	gboolean sources_changed = FALSE;
+	for (guint i = 0; i < hosts->sources->len; i++) {
+		HostsSource *source = g_ptr_array_index(hosts->sources, i);
+		source_previous[i] = source->enabled;
+		gchar *delta = hosts_source_delta_name(source->path);
+		gpointer value;
+		if (g_hash_table_lookup_extended(target, delta, NULL, &value)) {
+			g_hash_table_remove(target, delta);
+			sources_changed |= source->enabled != GPOINTER_TO_INT(value);
+			source->enabled = GPOINTER_TO_INT(value);
+		}
+		g_free(delta);
+	}
+
+	hosts->history_replaying = TRUE;
+	gboolean success = etc_hosts_sync(hosts);
+	hosts->history_replaying = FALSE;
+
+	if (success) {
+		hosts_propagate(hosts, (const gchar * const *) changed->pdata, (gboolean *) expected->data, changed->len);
+		if (sources_changed)
+			hosts_save(hosts->plugin, hosts);
+
+		// drop what was reverted; entries keep only the deltas we couldn't revert
+		for (guint i = end; i-- > start;) {
+			HistoryEntry *entry = g_ptr_array_index(entries, i);
+			for (guint k = entry->deltas->len; k-- > 0;) {
+				HostsDelta *delta = &g_array_index(entry->deltas, HostsDelta, k);
+				if (!g_hash_table_contains(target, delta->alias))
+					g_array_remove_index(entry->deltas, k);
+			}
+			if (!entry->deltas->len)
+				g_ptr_array_remove_index(entries, i);
+		}
+		history_save(entries, 0, entries->len);
+
+		// leftovers belong to other instances; they can revert them on their own undo
+		if (g_hash_table_size(target)) {
+			GString *names = g_string_new(NULL);
+			GHashTableIter iter;
+			gpointer key;
+			g_hash_table_iter_init(&iter, target);
+			while (g_hash_table_iter_next(&iter, &key, NULL)) {
+				gchar *source = hosts_source_delta_parse((gchar *) key);
+				g_string_append_printf(names, "\n%s", source ? source : (gchar *) key);
+				g_free(source);
+			}
+			g_warning("Some changes can't be reverted by this plugin instance:%s", names->str);
+			GtkWidget *dialog = gtk_message_dialog_new(
+				NULL, GTK_DIALOG_DESTROY_WITH_PARENT, GTK_MESSAGE_WARNING, GTK_BUTTONS_CLOSE,
+				"These hosts or sources aren't configured in this plugin, so their changes weren't "
+				"reverted. They stay in the history for the plugin that made them:%s", names->str
+			);
+			gtk_dialog_run(GTK_DIALOG(dialog));
+			gtk_widget_destroy(dialog);
+			g_string_free(names, TRUE);
+		}
+	}
+	else {
+		for (guint i = 0; i < count; i++)
+			hosts_set_enabled(hosts, i, previous[i]);
+		for (guint i = 0; i < hosts->sources->len; i++)
+			((HostsSource *) g_ptr_array_index(hosts->sources, i))->enabled = source_previous[i];
+	}
+
+	g_hash_table_destroy(target);
+	g_free(previous);
+	g_free(source_previous);
+	g_ptr_array_free(changed, TRUE);
+	g_array_free(expected, TRUE);
+	return success;
+}
+
+static gboolean history_undo_apply(HostsPlugin *hosts, gpointer data) {
+	GPtrArray *entries = history_load();
+	gboolean pruned = history_prune(hosts, entries);
+	gint index = history_undo_index(hosts, entries);
+	gboolean success = index >= 0 && history_revert(hosts, entries, index, index + 1);
+	// a successful revert saved the history already
+	if (pruned && !success)
+		history_save(entries, 0, entries->len);
+	g_ptr_array_unref(entries);
+	return success;
+}
+
+void hosts_history_undo(HostsPlugin *hosts) {
+	hosts_shared_run(hosts, history_undo_apply, NULL, NULL);
+}
+
+static gboolean history_restore_apply(HostsPlugin *hosts, gint64 *time) {
+	GPtrArray *entries = history_load();
+	gboolean pruned = history_prune(hosts, entries);
+	guint keep = 0;
+	while (keep < entries->len && ((HistoryEntry *) g_ptr_array_index(entries, keep))->time <= *time)
+		keep++;
+	gboolean success = history_revert(hosts, entries, keep, entries->len);
+	if (pruned && !success)
+		history_save(entries, 0, entries->len);
+	g_ptr_array_unref(entries);
+	return success;
+}
+
+void hosts_history_restore(HostsPlugin *hosts, gint64 time) {
+	gint64 *data = g_new(gint64, 1);
+	*data = time;
+	hosts_shared_run(hosts, (HostsSharedFunc) history_restore_apply, data, g_free);
+}
+
+// Short description of an entry for the menu, e.g. "Nov 3 14:02:11  +api.test -www.test"
+static gchar *history_entry_label(const gchar *prefix, HistoryEntry *entry) {
+	GDateTime *date = g_date_time_new_from_unix_local(entry->time / G_USEC_PER_SEC);
+	gchar *when = g_date_time_format(date, "%b %e %H:%M:%S");
+	g_date_time_unref(date);
+
+	GString *label = g_string_new(prefix);
+	g_string_append(label, when);
+	g_free(when);
+	for (guint k = 0; k < entry->deltas->len && k < 3; k++) {
+		HostsDelta *delta = &g_array_index(entry->deltas, HostsDelta, k);
+		gchar *source = hosts_source_delta_parse(delta->alias);
+		g_string_append_printf(label, "%s%c%s", k ? " " : "  ", delta->added ? '+' : '-', source ? source : delta->alias);
+		g_free(source);
+	}
+	if (entry->deltas->len > 3)
+		g_string_append_printf(label, " (%u more)", entry->deltas->len - 3);
+	return g_string_free(label, FALSE);
+}
+
+static void history_undo_activate(GtkMenuItem *item, HostsPlugin *hosts) {
+	hosts_history_undo(hosts);
+}
+
+static void history_restore_activate(GtkMenuItem *item, HostsPlugin *hosts) {
+	gint64 *time = g_object_get_data(G_OBJECT(item), "time");
+	hosts_history_restore(hosts, *time);
+}
+
+static void history_restore_item(HostsPlugin *hosts, GtkWidget *submenu, gchar *label, gint64 time) {
+	GtkWidget *item = gtk_menu_item_new_with_label(label);
+	g_free(label);
+	gint64 *data = g_new(gint64, 1);
+	*data = time;
+	g_object_set_data_full(G_OBJECT(item), "time", data, g_free);
+	g_signal_connect(item, "activate", G_CALLBACK(history_restore_activate), hosts);
+	gtk_menu_shell_append(GTK_MENU_SHELL(submenu), item);
+}
+
+void hosts_history_menu(HostsPlugin *hosts, GtkWidget *menu) {
+	GPtrArray *entries = history_load();
+	history_prune(hosts, entries);
+
+	// Undo last change made to something configured here
+	GtkWidget *undo_item = gtk_menu_item_new_with_label("Undo last change");
+	gint index = history_undo_index(hosts, entries);
+	if (index >= 0) {
+		gchar *tooltip = history_entry_label("Revert ", g_ptr_array_index(entries, index));
+		gtk_widget_set_tooltip_text(undo_item, tooltip);
+		g_free(tooltip);
+	}
+	else gtk_widget_set_sensitive(undo_item, FALSE);
+	g_signal_connect(undo_item, "activate", G_CALLBACK(history_undo_activate), hosts);
+	gtk_menu_shell_append(GTK_MENU_SHELL(menu), undo_item);
+
+	// Restore to time T: state right after an earlier change, or before the oldest one shown
+	GtkWidget *restore_item = gtk_menu_item_new_with_label("Restore to");
+	GtkWidget *submenu = gtk_menu_new();
+	guint oldest = entries->len > HISTORY_MENU_ENTRIES ? entries->len - HISTORY_MENU_ENTRIES : 0;
+	for (guint i = entries->len; i-- > oldest;) {
+		HistoryEntry *entry = g_ptr_array_index(entries, i);
+		if (i + 1 < entries->len)
+			history_restore_item(hosts, submenu, history_entry_label("After ", entry), entry->time);
+		if (i == oldest)
+			history_restore_item(hosts, submenu, history_entry_label("Before ", entry), entry->time - 1);
+	}
+	gtk_menu_item_set_submenu(GTK_MENU_ITEM(restore_item), submenu);
+	gtk_widget_set_sensitive(restore_item, entries->len > 0);
+	gtk_menu_shell_append(GTK_MENU_SHELL(menu), restore_item);
+
+	g_ptr_array_unref(entries);
+}
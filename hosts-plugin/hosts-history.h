@@ -0,0 +1,35 @@
+#ifndef __HOSTS_HISTORY_H__
+#define __HOSTS_HISTORY_H__
+
+G_BEGIN_DECLS
+
+// A single alias added to or removed from a line of /etc/hosts
+typedef struct {
+	gboolean added;
+	guint line;
+	gchar *alias;
+} HostsDelta;
+
+// New array to collect HostsDelta's; frees the aliases when destroyed
+GArray *hosts_delta_array_new(void);
+
+// Append a delta to the array
+void hosts_delta_append(GArray *deltas, gboolean added, guint line, const gchar *alias);
+
+// Record one write of /etc/hosts; base and result are checksums of the file before and after
+void hosts_history_record(const gchar *base, const gchar *result, GArray *deltas);
+
+// Revert the most recent recorded change that touches an alias or source configured in this
+// instance, in a single write; changes only other instances can revert are skipped. Does nothing
+// if there is no such change. Queued if another instance holds the write lock
+void hosts_history_undo(HostsPlugin *hosts);
+
+// Revert all changes recorded after time (microseconds, as g_get_real_time) in a single write
+void hosts_history_restore(HostsPlugin *hosts, gint64 time);
+
+// Append undo/restore actions to the dropdown menu
+void hosts_history_menu(HostsPlugin *hosts, GtkWidget *menu);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,168 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+
+#include <gtk/gtk.h>
+#include <libxfce4util/libxfce4util.h>
+#include <libxfce4panel/libxfce4panel.h>
+
+#include "hosts.h"
+#include "hosts-propagate.h"
+
+// How often to poll the resolver, and how long to wait before giving up (microseconds)
+#define PROPAGATE_POLL_INTERVAL (20 * G_TIME_SPAN_MILLISECOND)
+#define PROPAGATE_TIMEOUT (10 * G_TIME_SPAN_SECOND)
+
+// State for one propagation check; owned by the GTask
+typedef struct {
+	gchar *flush_command;
+	gchar **aliases;
+	gboolean *expected;
+	guint count;
+	// when the write returned (monotonic); the password prompt before it isn't propagation
+	gint64 written;
+	// microseconds spent in the flush command
+	gint64 flush_time;
+	// microseconds from the write until the alias resolved as expected; -1 if it never did
+	gint64 *latency;
+} PropagateData;
+
+static void propagate_data_free(PropagateData *data) {
+	g_free(data->flush_command);
+	g_strfreev(data->aliases);
+	g_free(data->expected);
+	g_free(data->latency);
+	g_free(data);
+}
+
+gchar *hosts_default_flush_command(void) {
+	// systemd-resolved is the common case; nscd and dnsmasq need root to flush, so users
+	// with those can point this at their own script instead
+	gchar *path = g_find_program_in_path("resolvectl");
+	if (path) {
+		g_free(path);
+		return g_strdup("resolvectl flush-caches");
+	}
+	return g_strdup("");
+}
+
+// Check if the resolver currently maps alias to 127.0.0.1
+static gboolean alias_resolves_local(const gchar *alias) {
+	struct addrinfo hints, *result = NULL;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(alias, NULL, &hints, &result) != 0)
+		return FALSE;
+
+	gboolean local = FALSE;
+	for (struct addrinfo *ai = result; ai; ai = ai->ai_next) {
+		struct sockaddr_in *addr = (struct sockaddr_in *) ai->ai_addr;
+		if (addr->sin_addr.s_addr == htonl(INADDR_LOOPBACK)) {
+			local = TRUE;
+			break;
+		}
+	}
+	freeaddrinfo(result);
+	return local;
+}
+
+// Worker thread: run the flush hook, then poll until everything resolves as expected
+static void propagate_thread(GTask *task, gpointer source, gpointer task_data, GCancellable *cancellable) {
+	PropagateData *data = (PropagateData *) task_data;
+
+	gint64 flush_start = g_get_monotonic_time();
+	if (data->flush_command && *data->flush_command) {
+		GError *error = NULL;
+		gint exit_status;
+		if (!g_spawn_command_line_sync(data->flush_command, NULL, NULL, &exit_status, &error)) {
+			g_warning("Failed to run cache flush command '%s': %s", data->flush_command, error->message);
+			g_error_free(error);
+		}
+		else if (exit_status != 0)
+			g_warning("Cache flush command '%s' failed with exit status %d", data->flush_command, exit_status);
+	}
+	data->flush_time = g_get_monotonic_time() - flush_start;
+
+	// the timeout covers polling only, however long the flush took
+	guint pending = data->count;
+	gint64 deadline = g_get_monotonic_time() + PROPAGATE_TIMEOUT;
+	while (pending && !g_cancellable_is_cancelled(cancellable)) {
+		for (guint i = 0; i < data->count; i++) {
+			if (data->latency[i] >= 0)
+				continue;
+			if (alias_resolves_local(data->aliases[i]) == data->expected[i]) {
+				data->latency[i] = g_get_monotonic_time() - data->written;
+				pending--;
+			}
+		}
+		if (!pending || g_get_monotonic_time() >= deadline)
+			break;
+		g_usleep(PROPAGATE_POLL_INTERVAL);
+	}
+
+	g_task_return_boolean(task, pending == 0);
+}
+
+// Main thread: report the per-alias latency
+static void propagate_done(GObject *source, GAsyncResult *result, gpointer user_data) {
+	GTask *task = G_TASK(result);
+	// plugin was freed while we were polling
+	if (g_cancellable_is_cancelled(g_task_get_cancellable(task)))
+		return;
+
+	HostsPlugin *hosts = (HostsPlugin *) user_data;
+	PropagateData *data = (PropagateData *) g_task_get_task_data(task);
+	GString *tooltip = g_string_new("Toggle hosts");
+	for (guint i = 0; i < data->count; i++) {
+		const gchar *state = data->expected[i] ? "enabled" : "disabled";
+		if (data->latency[i] >= 0) {
+			gdouble ms = data->latency[i] / (gdouble) G_TIME_SPAN_MILLISECOND;
+			g_message(
+				"%s %s; propagated in %.0f ms (cache flush took %.0f ms)", data->aliases[i], state, ms,
+				data->flush_time / (gdouble) G_TIME_SPAN_MILLISECOND
+			);
+			g_string_append_printf(tooltip, "\n%s %s in %.0f ms", data->aliases[i], state, ms);
+		}
+		else {
+			g_warning(
+				"%s %s, but still not resolving as expected after %d s",
+				data->aliases[i], state, (gint) (PROPAGATE_TIMEOUT / G_TIME_SPAN_SECOND)
+			);
+			g_string_append_printf(tooltip, "\n%s %s; not propagated yet", data->aliases[i], state);
+		}
+	}
+	gtk_widget_set_tooltip_text(hosts->button, tooltip->str);
+	g_string_free(tooltip, TRUE);
+}
+
+void hosts_propagate(HostsPlugin *hosts, const gchar * const *aliases, const gboolean *expected, guint count) {
+	if (!count)
+		return;
+
+	PropagateData *data = g_new0(PropagateData, 1);
+	data->flush_command = g_strdup(hosts->flush_command);
+	data->aliases = g_new0(gchar *, count + 1);
+	for (guint i = 0; i < count; i++)
+		data->aliases[i] = g_strdup(aliases[i]);
+	data->expected = g_new(gboolean, count);
+	data->latency = g_new(gint64, count);
+	for (guint i = 0; i < count; i++) {
+		data->expected[i] = expected[i];
+		data->latency[i] = -1;
+	}
+	data->count = count;
+	data->written = hosts->written;
+
+	GTask *task = g_task_new(NULL, hosts->propagation, propagate_done, hosts);
+	g_task_set_task_data(task, data, (GDestroyNotify) propagate_data_free);
+	g_task_run_in_thread(task, propagate_thread);
+	g_object_unref(task);
+}
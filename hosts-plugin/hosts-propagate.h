@@ -0,0 +1,16 @@
+#ifndef __HOSTS_PROPAGATE_H__
+#define __HOSTS_PROPAGATE_H__
+
+G_BEGIN_DECLS
+
+// Default cache flush command for this system; empty string if none was found
+gchar *hosts_default_flush_command(void);
+
+// Flush resolver caches and wait in the background until each alias resolves as expected
+// (127.0.0.1 if enabled, something else if not). The latency from when the write returned,
+// not counting the password prompt, is reported once all aliases propagate or we time out.
+void hosts_propagate(HostsPlugin *hosts, const gchar * const *aliases, const gboolean *expected, guint count);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,301 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+
+#include <gtk/gtk.h>
+#include <libxfce4util/libxfce4util.h>
+#include <libxfce4panel/libxfce4panel.h>
+
+#include "hosts.h"
+#include "hosts-shared.h"
+#include "hosts-sources.h"
+#include "hosts-state.h"
+
+// Coordination between plugin instances (several panels, or several plugins on one panel).
+// Instances may live in separate processes, so state is shared through files in the user's
+// runtime directory: a lock file serializing writers, and a small key file with each alias's
+// enabled flag plus a generation counter, and which aliases and sources each instance has
+// configured. A file monitor on the key file lets instances pick
+// up each other's changes as soon as they are published.
+
+#define SHARED_DIR "xfce4-hosts-plugin"
+#define SHARED_GROUP_STATE "state"
+#define SHARED_GROUP_ALIASES "aliases"
+// one group per instance listing its configured aliases and sources, followed by its unique id
+#define SHARED_GROUP_INSTANCE "instance:"
+
+// How often queued changes retry the lock while another instance holds it (milliseconds). Another
+// instance can hold it for as long as its password prompt is open, so this never blocks the panel
+#define SHARED_RETRY_INTERVAL 250
+
+// A change waiting for the write lock
+typedef struct {
+	HostsSharedFunc func;
+	gpointer data;
+	GDestroyNotify destroy;
+} SharedChange;
+
+// The lock is held per process, so instances sharing a process (or a nested main loop from an
+// error dialog) don't deadlock on their own flock
+static gint lock_fd = -1;
+static guint lock_depth = 0;
+
+gchar *hosts_shared_path(const gchar *name) {
+	gchar *dir = g_build_filename(g_get_user_runtime_dir(), SHARED_DIR, NULL);
+	g_mkdir_with_parents(dir, 0700);
+	gchar *path = g_build_filename(dir, name, NULL);
+	g_free(dir);
+	return path;
+}
+
+gchar *hosts_shared_stage_path(guint index) {
+	// not g_get_user_runtime_dir, which the helper can't trust to be the caller's own
+	gchar *dir = g_strdup_printf("/run/user/%u/%s", (guint) getuid(), SHARED_DIR);
+	g_mkdir_with_parents(dir, 0700);
+	gchar *path = g_strdup_printf("%s/stage-%u", dir, index);
+	g_free(dir);
+	return path;
+}
+
+static GKeyFile *shared_state_load(void) {
+	GKeyFile *state = g_key_file_new();
+	gchar *path = hosts_shared_path("state");
+	// missing file is fine; no instance has published yet
+	g_key_file_load_from_file(state, path, G_KEY_FILE_NONE, NULL);
+	g_free(path);
+	return state;
+}
+
+// Adopt enabled flags from a newer generation of the shared state. Returns true if any changed
+static gboolean shared_merge(HostsPlugin *hosts) {
+	GKeyFile *state = shared_state_load();
+	guint64 generation = g_key_file_get_uint64(state, SHARED_GROUP_STATE, "generation", NULL);
+	gboolean changed = FALSE;
+	if (generation > hosts->shared_generation) {
+		hosts->shared_generation = generation;
+		for (guint i = 0; i < hosts->n_names; i++) {
+			const gchar *name = hosts_name(hosts, i);
+			if (!g_key_file_has_key(state, SHARED_GROUP_ALIASES, name, NULL))
+				continue;
+			gboolean enabled = g_key_file_get_boolean(state, SHARED_GROUP_ALIASES, name, NULL);
+			if (enabled != hosts_is_enabled(hosts, i)) {
+				DBG("Host %s was %s by another instance", name, enabled ? "enabled" : "disabled");
+				hosts_set_enabled(hosts, i, enabled);
+				changed = TRUE;
+			}
+		}
+	}
+	g_key_file_free(state);
+	return changed;
+}
+
+static void shared_state_changed(
+	GFileMonitor *monitor, GFile *file, GFile *other_file, GFileMonitorEvent event, HostsPlugin *hosts
+){
+	if (event == G_FILE_MONITOR_EVENT_DELETED)
+		return;
+	// our own writes have a generation we've already seen, so they're skipped here
+	if (shared_merge(hosts))
+		hosts_save(hosts->plugin, hosts);
+}
+
+void hosts_shared_init(HostsPlugin *hosts) {
+	hosts->shared_pending = g_queue_new();
+
+	gchar *path = hosts_shared_path("state");
+	GFile *file = g_file_new_for_path(path);
+	g_free(path);
+
+	GError *error = NULL;
+	hosts->shared_monitor = g_file_monitor_file(file, G_FILE_MONITOR_NONE, NULL, &error);
+	g_object_unref(file);
+	if (hosts->shared_monitor == NULL) {
+		g_warning("Can't watch for changes from other instances: %s", error->message);
+		g_error_free(error);
+		return;
+	}
+	g_signal_connect(hosts->shared_monitor, "changed", G_CALLBACK(shared_state_changed), hosts);
+}
+
+static void shared_change_free(SharedChange *change) {
+	if (change->destroy)
+		change->destroy(change->data);
+	g_free(change);
+}
+
+void hosts_shared_free(HostsPlugin *hosts) {
+	if (hosts->shared_retry)
+		g_source_remove(hosts->shared_retry);
+	if (!g_queue_is_empty(hosts->shared_pending))
+		g_warning("Dropping %u changes still waiting for another instance to write /etc/hosts", g_queue_get_length(hosts->shared_pending));
+	g_queue_free_full(hosts->shared_pending, (GDestroyNotify) shared_change_free);
+	if (hosts->shared_monitor) {
+		g_file_monitor_cancel(hosts->shared_monitor);
+		g_object_unref(hosts->shared_monitor);
+		hosts->shared_monitor = NULL;
+	}
+}
+
+// Try to take the flock on fd, without waiting
+static gboolean shared_lock(gint fd) {
+	while (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+		if (errno == EWOULDBLOCK)
+			return FALSE;
+		if (errno != EINTR) {
+			// not a contention problem; carry on unlocked rather than block every write
+			g_warning("Failed to lock shared state: %s", g_strerror(errno));
+			return TRUE;
+		}
+	}
+	return TRUE;
+}
+
+gboolean hosts_shared_begin(HostsPlugin *hosts) {
+	if (lock_depth == 0) {
+		gchar *path = hosts_shared_path("lock");
+		lock_fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+		if (lock_fd < 0)
+			g_warning("Failed to open lock file %s: %s", path, g_strerror(errno));
+		else if (!shared_lock(lock_fd)) {
+			DBG("Another instance is writing /etc/hosts");
+			close(lock_fd);
+			lock_fd = -1;
+			g_free(path);
+			return FALSE;
+		}
+		g_free(path);
+	}
+	lock_depth++;
+	shared_merge(hosts);
+	return TRUE;
+}
+
+// Record what this instance has configured, so others know which history deltas still matter
+static void shared_register(HostsPlugin *hosts, GKeyFile *state) {
+	gchar *group = g_strdup_printf(SHARED_GROUP_INSTANCE "%d", xfce_panel_plugin_get_unique_id(hosts->plugin));
+	gchar **aliases = hosts_dup_names(hosts);
+	g_key_file_set_string_list(state, group, "aliases", (const gchar * const *) aliases, hosts->n_names);
+	g_strfreev(aliases);
+	gchar **sources = g_new0(gchar *, hosts->sources->len + 1);
+	for (guint i = 0; i < hosts->sources->len; i++)
+		sources[i] = hosts_source_delta_name(((HostsSource *) g_ptr_array_index(hosts->sources, i))->path);
+	g_key_file_set_string_list(state, group, "sources", (const gchar * const *) sources, hosts->sources->len);
+	g_strfreev(sources);
+	g_free(group);
+}
+
+GHashTable *hosts_shared_configured(HostsPlugin *hosts) {
+	GHashTable *configured = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	GKeyFile *state = shared_state_load();
+	// our own, which may be newer than what we last published
+	shared_register(hosts, state);
+	gchar **groups = g_key_file_get_groups(state, NULL);
+	for (guint i = 0; groups[i]; i++) {
+		if (!g_str_has_prefix(groups[i], SHARED_GROUP_INSTANCE))
+			continue;
+		const gchar *keys[] = {"aliases", "sources"};
+		for (guint k = 0; k < G_N_ELEMENTS(keys); k++) {
+			gchar **names = g_key_file_get_string_list(state, groups[i], keys[k], NULL, NULL);
+			for (guint n = 0; names && names[n]; n++)
+				g_hash_table_add(configured, names[n]);
+			// the strings are owned by the table now
+			g_free(names);
+		}
+	}
+	g_strfreev(groups);
+	g_key_file_free(state);
+	return configured;
+}
+
+void hosts_shared_unregister(HostsPlugin *hosts) {
+	if (!hosts_shared_begin(hosts)) {
+		g_warning("Couldn't remove this instance from the shared state; another instance is writing");
+		return;
+	}
+	GKeyFile *state = shared_state_load();
+	gchar *group = g_strdup_printf(SHARED_GROUP_INSTANCE "%d", xfce_panel_plugin_get_unique_id(hosts->plugin));
+	if (g_key_file_remove_group(state, group, NULL)) {
+		gchar *path = hosts_shared_path("state");
+		g_key_file_save_to_file(state, path, NULL);
+		g_free(path);
+	}
+	g_free(group);
+	g_key_file_free(state);
+	hosts_shared_end(hosts, FALSE);
+}
+
+// Apply queued changes in order, for as long as the lock can be had
+static gboolean shared_drain(HostsPlugin *hosts) {
+	// a change is running (e.g. showing an error dialog); its turn ends first
+	if (hosts->shared_running)
+		return G_SOURCE_CONTINUE;
+	while (!g_queue_is_empty(hosts->shared_pending)) {
+		if (!hosts_shared_begin(hosts))
+			return G_SOURCE_CONTINUE;
+		SharedChange *change = g_queue_pop_head(hosts->shared_pending);
+		hosts->shared_running = TRUE;
+		hosts_shared_end(hosts, change->func(hosts, change->data));
+		hosts->shared_running = FALSE;
+		shared_change_free(change);
+	}
+	if (hosts->button)
+		gtk_widget_set_tooltip_text(hosts->button, "Toggle hosts");
+	hosts->shared_retry = 0;
+	return G_SOURCE_REMOVE;
+}
+
+void hosts_shared_run(HostsPlugin *hosts, HostsSharedFunc func, gpointer data, GDestroyNotify destroy) {
+	// run right away, unless earlier changes are still waiting their turn
+	if (!hosts->shared_running && g_queue_is_empty(hosts->shared_pending) && hosts_shared_begin(hosts)) {
+		hosts->shared_running = TRUE;
+		hosts_shared_end(hosts, func(hosts, data));
+		hosts->shared_running = FALSE;
+		if (destroy)
+			destroy(data);
+		return;
+	}
+
+	SharedChange *change = g_new(SharedChange, 1);
+	change->func = func;
+	change->data = data;
+	change->destroy = destroy;
+	g_queue_push_tail(hosts->shared_pending, change);
+	if (!hosts->shared_retry)
+		hosts->shared_retry = g_timeout_add(SHARED_RETRY_INTERVAL, (GSourceFunc) shared_drain, hosts);
+	if (hosts->button)
+		gtk_widget_set_tooltip_text(hosts->button, "Toggle hosts\nWaiting for another instance to finish writing /etc/hosts");
+}
+
+void hosts_shared_end(HostsPlugin *hosts, gboolean publish) {
+	if (publish) {
+		GKeyFile *state = shared_state_load();
+		guint64 generation = g_key_file_get_uint64(state, SHARED_GROUP_STATE, "generation", NULL) + 1;
+		g_key_file_set_uint64(state, SHARED_GROUP_STATE, "generation", generation);
+		for (guint i = 0; i < hosts->n_names; i++)
+			g_key_file_set_boolean(state, SHARED_GROUP_ALIASES, hosts_name(hosts, i), hosts_is_enabled(hosts, i));
+		shared_register(hosts, state);
+
+		gchar *path = hosts_shared_path("state");
+		GError *error = NULL;
+		if (g_key_file_save_to_file(state, path, &error))
+			hosts->shared_generation = generation;
+		else {
+			g_warning("Failed to publish state to other instances: %s", error->message);
+			g_error_free(error);
+		}
+		g_free(path);
+		g_key_file_free(state);
+	}
+
+	g_return_if_fail(lock_depth > 0);
+	if (--lock_depth == 0 && lock_fd >= 0) {
+		// closing the descriptor releases the flock
+		close(lock_fd);
+		lock_fd = -1;
+	}
+}
@@ -0,0 +1,48 @@
+#ifndef __HOSTS_SHARED_H__
+#define __HOSTS_SHARED_H__
+
+G_BEGIN_DECLS
+
+// Path of a file in the per-user directory shared by all instances; the directory is created
+gchar *hosts_shared_path(const gchar *name);
+
+// Path where target index is staged for the commit helper, which only reads staging files from
+// the user's /run/user directory; the directory is created
+gchar *hosts_shared_stage_path(guint index);
+
+// Start watching for alias changes made by other plugin instances, and set up the queue of
+// changes waiting for the write lock
+void hosts_shared_init(HostsPlugin *hosts);
+
+// Stop watching for changes from other instances; changes still queued are dropped
+void hosts_shared_free(HostsPlugin *hosts);
+
+// Take the per-user write lock, then pick up any state other instances published. Doesn't wait;
+// returns false (and end must not be called) if another instance holds the lock. Changes should
+// go through hosts_shared_run rather than calling this directly.
+gboolean hosts_shared_begin(HostsPlugin *hosts);
+
+// Publish our enabled flags to other instances (if publish is set) and release the write lock
+void hosts_shared_end(HostsPlugin *hosts, gboolean publish);
+
+// A change to enabled flags or sources, followed by etc_hosts_sync(). Runs with the write lock
+// held; returns whether to publish the new state to other instances
+typedef gboolean (*HostsSharedFunc)(HostsPlugin *hosts, gpointer data);
+
+// Run func with the write lock held, so that only one instance writes at a time and it always
+// starts from the latest state. If another instance holds the lock, func is queued and run from
+// the main loop once it's free; queued changes run in the order they were made. data is freed
+// with destroy once func has run. Since func may run later, it should look up aliases and
+// sources by name rather than index.
+void hosts_shared_run(HostsPlugin *hosts, HostsSharedFunc func, gpointer data, GDestroyNotify destroy);
+
+// Set of the aliases and sources (as history delta names) configured in any instance, this one
+// included. Other instances' lists are as of their last publish
+GHashTable *hosts_shared_configured(HostsPlugin *hosts);
+
+// Forget this instance's configured aliases and sources, when it is removed from the panel
+void hosts_shared_unregister(HostsPlugin *hosts);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,500 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include <gtk/gtk.h>
+#include <glib/gstdio.h>
+#include <libxfce4util/libxfce4util.h>
+#include <libxfce4panel/libxfce4panel.h>
+
+#include "hosts.h"
+#include "hosts-sources.h"
+#include "hosts-history.h"
+#include "hosts-state.h"
+
+// External sources are third-party hosts-format lists (e.g. blocklists) merged into a managed
+// block at the end of /etc/hosts. The merge streams each file line by line and deduplicates
+// hostnames through a set of 64-bit hashes, kept under half full, so memory stays at 16-32 bytes
+// per distinct hostname rather than proportional to the size of the lists.
+// Each source has its own sub-block, tagged with its path, the checksum of its contents, and a
+// digest of the sub-blocks before it; a source's hostnames are deduplicated against the rest of
+// the file, the aliases, and those earlier sub-blocks. A sub-block is copied through as long as
+// its source and everything before it are unchanged, so only sources that changed, or come after
+// one that did, are merged again. The block as a whole is tagged with a digest of all sub-blocks;
+// when it matches, sync copies the block through without looking inside.
+// Source configuration isn't shared between instances, so sub-blocks of sources another instance
+// has configured are left in place untouched.
+
+#define SOURCES_READ_SIZE (64 * 1024)
+
+// Open addressing set of 64-bit hashes; 0 marks an empty slot
+typedef struct {
+	guint64 *slots;
+	gsize mask;
+	gsize count;
+} HashSet64;
+
+static void hash_set_init(HashSet64 *set) {
+	set->mask = 1023;
+	set->slots = g_new0(guint64, set->mask + 1);
+	set->count = 0;
+}
+
+static gboolean hash_set_insert(guint64 *slots, gsize mask, guint64 hash) {
+	for (gsize i = hash & mask;; i = (i + 1) & mask) {
+		if (slots[i] == hash)
+			return FALSE;
+		if (!slots[i]) {
+			slots[i] = hash;
+			return TRUE;
+		}
+	}
+}
+
+// Returns true if the hash wasn't in the set yet
+static gboolean hash_set_add(HashSet64 *set, guint64 hash) {
+	if (!hash)
+		hash = 1;
+	// keep load under 1/2
+	if ((set->count + 1) * 2 > set->mask + 1) {
+		gsize mask = set->mask * 2 + 1;
+		guint64 *slots = g_new0(guint64, mask + 1);
+		for (gsize i = 0; i <= set->mask; i++) {
+			if (set->slots[i])
+				hash_set_insert(slots, mask, set->slots[i]);
+		}
+		g_free(set->slots);
+		set->slots = slots;
+		set->mask = mask;
+	}
+	if (!hash_set_insert(set->slots, set->mask, hash))
+		return FALSE;
+	set->count++;
+	return TRUE;
+}
+
+// FNV-1a, case insensitive since hostnames are
+static guint64 hostname_hash(const gchar *host, gsize length) {
+	guint64 hash = G_GUINT64_CONSTANT(14695981039346656037);
+	for (gsize i = 0; i < length; i++) {
+		hash ^= (guchar) g_ascii_tolower(host[i]);
+		hash *= G_GUINT64_CONSTANT(1099511628211);
+	}
+	return hash;
+}
+
+// Next whitespace separated token of a hosts line; stops at a comment. Returns false at the end
+static gboolean next_token(const gchar **p, const gchar *end, const gchar **token, gsize *length) {
+	while (*p < end && (**p == ' ' || **p == '\t' || **p == '\r'))
+		(*p)++;
+	if (*p >= end || **p == '#')
+		return FALSE;
+	*token = *p;
+	while (*p < end && **p != ' ' && **p != '\t' && **p != '\r' && **p != '#')
+		(*p)++;
+	*length = *p - *token;
+	return TRUE;
+}
+
+// Add the hostnames (everything after the address) of a hosts line to the set
+static void seed_line(HashSet64 *seen, const gchar *line, const gchar *end) {
+	const gchar *token;
+	gsize length;
+	if (!next_token(&line, end, &token, &length))
+		return;
+	while (next_token(&line, end, &token, &length))
+		hash_set_add(seen, hostname_hash(token, length));
+}
+
+// Append a source line to out, keeping only hostnames not seen before
+static void merge_line(HashSet64 *seen, GString *out, const gchar *line, const gchar *end) {
+	const gchar *token;
+	gsize length;
+	gchar address[64];
+	if (!next_token(&line, end, &token, &length) || length >= sizeof(address))
+		return;
+	memcpy(address, token, length);
+	address[length] = '\0';
+	if (!g_hostname_is_ip_address(address))
+		return;
+
+	gsize mark = out->len;
+	g_string_append_len(out, address, length);
+	gboolean kept = FALSE;
+	while (next_token(&line, end, &token, &length)) {
+		if (hash_set_add(seen, hostname_hash(token, length))) {
+			g_string_append_c(out, ' ');
+			g_string_append_len(out, token, length);
+			kept = TRUE;
+		}
+	}
+	if (kept)
+		g_string_append_c(out, '\n');
+	else
+		g_string_truncate(out, mark);
+}
+
+HostsSource *hosts_source_new(const gchar *name, const gchar *path) {
+	HostsSource *source = g_new0(HostsSource, 1);
+	source->name = g_strdup(name);
+	source->path = g_strdup(path);
+	return source;
+}
+
+void hosts_source_free(HostsSource *source) {
+	g_free(source->name);
+	g_free(source->path);
+	g_free(source->signature);
+	g_free(source->checksum);
+	g_free(source);
+}
+
+static gint compare_paths(gconstpointer a, gconstpointer b) {
+	return g_strcmp0(*(const gchar **) a, *(const gchar **) b);
+}
+
+// Files making up a source, in a stable order: the file itself, or a directory's visible files
+static GPtrArray *source_files(HostsSource *source) {
+	GPtrArray *files = g_ptr_array_new_with_free_func(g_free);
+	if (!g_file_test(source->path, G_FILE_TEST_IS_DIR)) {
+		g_ptr_array_add(files, g_strdup(source->path));
+		return files;
+	}
+	GDir *dir = g_dir_open(source->path, 0, NULL);
+	if (!dir)
+		return files;
+	const gchar *name;
+	while ((name = g_dir_read_name(dir))) {
+		if (name[0] == '.')
+			continue;
+		gchar *path = g_build_filename(source->path, name, NULL);
+		if (g_file_test(path, G_FILE_TEST_IS_REGULAR))
+			g_ptr_array_add(files, path);
+		else
+			g_free(path);
+	}
+	g_dir_close(dir);
+	g_ptr_array_sort(files, compare_paths);
+	return files;
+}
+
+// Refresh the source's content checksum, unless no file changed size or mtime since last time
+static void source_update_checksum(HostsSource *source) {
+	GPtrArray *files = source_files(source);
+	GString *signature = g_string_new(NULL);
+	for (guint i = 0; i < files->len; i++) {
+		GStatBuf st;
+		const gchar *path = g_ptr_array_index(files, i);
+		if (g_stat(path, &st) == 0)
+			g_string_append_printf(signature, "%s %" G_GINT64_FORMAT " %" G_GINT64_FORMAT "\n",
+				path, (gint64) st.st_size, (gint64) st.st_mtime);
+		else
+			g_string_append_printf(signature, "%s missing\n", path);
+	}
+	if (source->checksum && g_strcmp0(signature->str, source->signature) == 0) {
+		g_string_free(signature, TRUE);
+		g_ptr_array_unref(files);
+		return;
+	}
+
+	DBG("Hashing external source %s", source->name);
+	GChecksum *checksum = g_checksum_new(G_CHECKSUM_SHA256);
+	guchar *buffer = g_malloc(SOURCES_READ_SIZE);
+	for (guint i = 0; i < files->len; i++) {
+		GFile *file = g_file_new_for_path(g_ptr_array_index(files, i));
+		GError *error = NULL;
+		GFileInputStream *stream = g_file_read(file, NULL, &error);
+		if (stream) {
+			gssize n;
+			while ((n = g_input_stream_read(G_INPUT_STREAM(stream), buffer, SOURCES_READ_SIZE, NULL, &error)) > 0)
+				g_checksum_update(checksum, buffer, n);
+			g_object_unref(stream);
+		}
+		if (error) {
+			g_warning("Failed to read external source %s: %s", source->name, error->message);
+			g_error_free(error);
+		}
+		// file boundary, so moving lines between files changes the checksum
+		g_checksum_update(checksum, (const guchar *) "\0", 1);
+		g_object_unref(file);
+	}
+	g_free(buffer);
+
+	g_free(source->checksum);
+	source->checksum = g_strdup(g_checksum_get_string(checksum));
+	g_checksum_free(checksum);
+	g_free(source->signature);
+	source->signature = g_string_free(signature, FALSE);
+	g_ptr_array_unref(files);
+}
+
+// Add a sub-block to the chain of sub-blocks before the next one
+static void chain_update(GChecksum *chain, const gchar *path, gsize path_length, const gchar *checksum, gsize checksum_length) {
+	g_checksum_update(chain, (const guchar *) path, path_length);
+	g_checksum_update(chain, (const guchar *) "", 1);
+	g_checksum_update(chain, (const guchar *) checksum, checksum_length);
+	g_checksum_update(chain, (const guchar *) "", 1);
+}
+
+// Digest of the sub-blocks chained so far, leaving the chain open for more
+static gchar *chain_digest(GChecksum *chain) {
+	GChecksum *copy = g_checksum_copy(chain);
+	gchar *digest = g_strdup(g_checksum_get_string(copy));
+	g_checksum_free(copy);
+	return digest;
+}
+
+gchar *hosts_sources_digest(HostsPlugin *hosts) {
+	GChecksum *digest = NULL;
+	for (guint i = 0; i < hosts->sources->len; i++) {
+		HostsSource *source = g_ptr_array_index(hosts->sources, i);
+		if (!source->enabled)
+			continue;
+		source_update_checksum(source);
+		if (!digest)
+			digest = g_checksum_new(G_CHECKSUM_SHA256);
+		chain_update(digest, source->path, strlen(source->path), source->checksum, strlen(source->checksum));
+	}
+	if (!digest)
+		return NULL;
+	gchar *result = g_strdup(g_checksum_get_string(digest));
+	g_checksum_free(digest);
+	return result;
+}
+
+// Sub-block of one source in the existing block: its header line through the line before the next
+typedef struct {
+	const gchar *start;
+	const gchar *end;
+	// checksum, prefix and path from the header, not NUL terminated
+	const gchar *checksum;
+	gsize checksum_length;
+	const gchar *prefix;
+	gsize prefix_length;
+	const gchar *path;
+	gsize path_length;
+} SourceSpan;
+
+// Find the sub-blocks in [start, end) of the old block. Only header lines are visited, since
+// merged lines never start with a comment
+static GArray *source_spans(const gchar *start, const gchar *end) {
+	GArray *spans = g_array_new(FALSE, FALSE, sizeof(SourceSpan));
+	const gchar *marker = "\n" HOSTS_SOURCES_ITEM;
+	const gchar *hit = g_strstr_len(start, end - start, marker);
+	while (hit) {
+		SourceSpan span;
+		span.start = hit + 1;
+		const gchar *header = span.start + strlen(HOSTS_SOURCES_ITEM);
+		const gchar *header_end = memchr(header, '\n', end - header);
+		if (!header_end)
+			header_end = end;
+		hit = header_end < end ? g_strstr_len(header_end, end - header_end, marker) : NULL;
+		// headers from older versions, without a prefix, never match and are merged again
+		const gchar *space = memchr(header, ' ', header_end - header);
+		const gchar *second = space ? memchr(space + 1, ' ', header_end - space - 1) : NULL;
+		span.checksum = header;
+		span.checksum_length = space ? (gsize) (space - header) : 0;
+		span.prefix = space ? space + 1 : header_end;
+		span.prefix_length = second ? (gsize) (second - span.prefix) : 0;
+		span.path = second ? second + 1 : span.prefix;
+		span.path_length = header_end - span.path;
+		// runs up to the next header, or the end marker
+		const gchar *close = hit ? hit : g_strstr_len(header_end, end - header_end, "\n" HOSTS_SOURCES_END);
+		span.end = close ? close + 1 : end;
+		g_array_append_val(spans, span);
+	}
+	return spans;
+}
+
+static gboolean span_field_is(const gchar *field, gsize length, const gchar *value) {
+	return length == strlen(value) && strncmp(field, value, length) == 0;
+}
+
+// The old sub-block can be reused if the source hasn't changed, and neither have the sub-blocks
+// before it, which it was deduplicated against
+static gboolean span_matches(const SourceSpan *span, const HostsSource *source, const gchar *prefix) {
+	return span_field_is(span->checksum, span->checksum_length, source->checksum)
+		&& span_field_is(span->prefix, span->prefix_length, prefix);
+}
+
+// Add the hostnames of lines in [start, end) to the set
+static void seed_lines(HashSet64 *seen, const gchar *start, const gchar *end) {
+	for (const gchar *line = start; line < end;) {
+		const gchar *newline = memchr(line, '\n', end - line);
+		const gchar *line_end = newline ? newline : end;
+		seed_line(seen, line, line_end);
+		if (!newline)
+			break;
+		line = newline + 1;
+	}
+}
+
+// Seed a set with the hostnames of our aliases and of contents outside the old block
+static void seed_set(HashSet64 *seeds, HostsPlugin *hosts, const gchar *contents, gsize length, gsize skip_start, gsize skip_end) {
+	hash_set_init(seeds);
+	for (guint k = 0; k < hosts->n_names; k++)
+		hash_set_add(seeds, hostname_hash(hosts_name(hosts, k), strlen(hosts_name(hosts, k))));
+	seed_lines(seeds, contents, contents + skip_start);
+	seed_lines(seeds, contents + skip_end, contents + length);
+}
+
+gchar *hosts_source_delta_name(const gchar *path) {
+	gchar *escaped = g_uri_escape_string(path, NULL, FALSE);
+	gchar *delta = g_strconcat(HOSTS_SOURCE_DELTA, escaped, NULL);
+	g_free(escaped);
+	return delta;
+}
+
+gchar *hosts_source_delta_parse(const gchar *alias) {
+	if (!g_str_has_prefix(alias, HOSTS_SOURCE_DELTA))
+		return NULL;
+	return g_uri_unescape_string(alias + strlen(HOSTS_SOURCE_DELTA), NULL);
+}
+
+// State of one merge, as sub-blocks are appended to the new block in order
+typedef struct {
+	HostsPlugin *hosts;
+	GString *out;
+	// sub-blocks appended so far
+	GChecksum *chain;
+	guint count;
+	// hostnames that take precedence over the next source merged: those elsewhere in the file, our
+	// aliases, and everything in the sub-blocks before it. Only built if some source needs merging
+	HashSet64 seen;
+	// end of the part of out already added to seen
+	gsize seen_end;
+	// old file, and the old block within it
+	const gchar *contents;
+	gsize length, skip_start, skip_end;
+} SourcesMerge;
+
+// Append a source's sub-block, copying its old span through if it is still valid
+static void merge_source(SourcesMerge *merge, HostsSource *source, const SourceSpan *span) {
+	GString *out = merge->out;
+	gchar *prefix = chain_digest(merge->chain);
+	if (span && span_matches(span, source, prefix)) {
+		DBG("External source %s unchanged", source->name);
+		g_string_append_len(out, span->start, span->end - span->start);
+	}
+	else {
+		DBG("Merging external source %s", source->name);
+		if (!merge->seen.slots)
+			seed_set(&merge->seen, merge->hosts, merge->contents, merge->length, merge->skip_start, merge->skip_end);
+		seed_lines(&merge->seen, out->str + merge->seen_end, out->str + out->len);
+		gsize count = merge->seen.count;
+		g_string_append_printf(out, "%s%s %s %s\n", HOSTS_SOURCES_ITEM, source->checksum, prefix, source->path);
+
+		GPtrArray *files = source_files(source);
+		for (guint f = 0; f < files->len; f++) {
+			GFile *file = g_file_new_for_path(g_ptr_array_index(files, f));
+			GError *error = NULL;
+			GFileInputStream *stream = g_file_read(file, NULL, &error);
+			if (stream) {
+				GDataInputStream *data = g_data_input_stream_new(G_INPUT_STREAM(stream));
+				gchar *line;
+				gsize line_length;
+				while ((line = g_data_input_stream_read_line(data, &line_length, NULL, &error))) {
+					merge_line(&merge->seen, out, line, line + line_length);
+					g_free(line);
+				}
+				g_object_unref(data);
+				g_object_unref(stream);
+			}
+			if (error) {
+				g_warning("Failed to read external source %s: %s", source->name, error->message);
+				g_error_free(error);
+			}
+			g_object_unref(file);
+		}
+		g_ptr_array_unref(files);
+		// already in the set
+		merge->seen_end = out->len;
+		DBG("Merged %" G_GSIZE_FORMAT " distinct hostnames", merge->seen.count - count);
+	}
+	g_free(prefix);
+	chain_update(merge->chain, source->path, strlen(source->path), source->checksum, strlen(source->checksum));
+	merge->count++;
+}
+
+static void source_delta_append(GArray *deltas, gboolean added, guint line, const gchar *path) {
+	gchar *delta = hosts_source_delta_name(path);
+	hosts_delta_append(deltas, added, line, delta);
+	g_free(delta);
+}
+
+void hosts_sources_merge(
+	HostsPlugin *hosts, GString *out, GHashTable *configured,
+	const gchar *contents, gsize length, gsize skip_start, gsize skip_end,
+	GArray *deltas, guint line
+){
+	GArray *spans = source_spans(contents + skip_start, contents + skip_end);
+	SourcesMerge merge = {
+		hosts, out, g_checksum_new(G_CHECKSUM_SHA256), 0, { NULL, 0, 0 }, out->len,
+		contents, length, skip_start, skip_end
+	};
+	gsize block_start = out->len;
+	gboolean *placed = g_new0(gboolean, MAX(hosts->sources->len, 1));
+
+	// Sub-blocks keep their order, so enabling a source only merges that one, at the end
+	for (guint s = 0; s < spans->len; s++) {
+		SourceSpan *span = &g_array_index(spans, SourceSpan, s);
+		HostsSource *source = NULL;
+		gboolean ours = FALSE;
+		for (guint i = 0; i < hosts->sources->len && !ours; i++) {
+			HostsSource *candidate = g_ptr_array_index(hosts->sources, i);
+			if (span_field_is(span->path, span->path_length, candidate->path)) {
+				ours = TRUE;
+				// a second sub-block for the same source is dropped
+				if (!placed[i])
+					source = candidate;
+				placed[i] = TRUE;
+			}
+		}
+
+		if (ours && !source)
+			continue;
+		if (!source) {
+			// Another instance's source: leave it alone, as a whole block is left alone by instances
+			// without sources. If sub-blocks before it changed, that instance merges it again on its
+			// next write. Sources nobody has configured anymore (or old headers) are dropped
+			gchar *path = g_strndup(span->path, span->path_length);
+			gchar *delta = hosts_source_delta_name(path);
+			gboolean foreign = configured && g_hash_table_contains(configured, delta);
+			g_free(delta);
+			g_free(path);
+			if (!foreign)
+				continue;
+			g_string_append_len(out, span->start, span->end - span->start);
+			chain_update(merge.chain, span->path, span->path_length, span->checksum, span->checksum_length);
+			merge.count++;
+		}
+		// record sources that were enabled or disabled since the old block, for the history
+		else if (!source->enabled)
+			source_delta_append(deltas, FALSE, line, source->path);
+		else
+			merge_source(&merge, source, span);
+	}
+	// newly enabled sources go at the end
+	for (guint i = 0; i < hosts->sources->len; i++) {
+		HostsSource *source = g_ptr_array_index(hosts->sources, i);
+		if (placed[i] || !source->enabled)
+			continue;
+		source_delta_append(deltas, TRUE, line, source->path);
+		merge_source(&merge, source, NULL);
+	}
+
+	// tag the block with the digest of all its sub-blocks, or drop it if there are none
+	if (merge.count) {
+		gchar *header = g_strdup_printf("%s %s\n", HOSTS_SOURCES_BEGIN, g_checksum_get_string(merge.chain));
+		g_string_insert(out, block_start, header);
+		g_free(header);
+		g_string_append_printf(out, "%s\n", HOSTS_SOURCES_END);
+	}
+
+	g_checksum_free(merge.chain);
+	g_free(merge.seen.slots);
+	g_free(placed);
+	g_array_free(spans, TRUE);
+}
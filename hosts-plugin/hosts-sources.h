@@ -0,0 +1,50 @@
+#ifndef __HOSTS_SOURCES_H__
+#define __HOSTS_SOURCES_H__
+
+G_BEGIN_DECLS
+
+// Markers around the block of merged external sources in /etc/hosts; the begin marker is
+// followed by a digest of the sub-blocks' paths and checksums
+#define HOSTS_SOURCES_BEGIN "# BEGIN xfce4-hosts-plugin sources"
+#define HOSTS_SOURCES_END "# END xfce4-hosts-plugin sources"
+// Header of each source's sub-block within the block, followed by "<checksum> <prefix> <path>",
+// prefix being the digest of the sub-blocks before it
+#define HOSTS_SOURCES_ITEM "# source "
+
+// Prefix of history deltas recording a source being enabled or disabled, rather than an alias
+#define HOSTS_SOURCE_DELTA "source:"
+
+// Add a new source (disabled); path is a hosts-format file or a directory of them
+HostsSource *hosts_source_new(const gchar *name, const gchar *path);
+
+void hosts_source_free(HostsSource *source);
+
+// Digest of the enabled sources' paths and contents, or NULL if none are enabled; it matches the
+// begin marker of a block holding just those sources, in this order. Contents are only re-hashed when a file's
+// size or modification time changed since the last call.
+gchar *hosts_sources_digest(HostsPlugin *hosts);
+
+// Append the block of enabled sources to out, or nothing if there are no sub-blocks left. The old
+// block is at [skip_start, skip_end) of contents. Sub-blocks of sources other instances have
+// configured (configured being hosts_shared_configured, or NULL) are kept as they are; of the
+// others, those of our disabled sources are dropped, and sub-blocks unchanged since the old block,
+// along with all before them, are copied through. The rest are merged anew, skipping hostnames
+// present elsewhere in contents, configured as aliases, or in an earlier sub-block. Sources enabled
+// or disabled since the old block are appended to deltas, at line. Call hosts_sources_digest
+// first, so the sources' checksums are current.
+void hosts_sources_merge(
+	HostsPlugin *hosts, GString *out, GHashTable *configured,
+	const gchar *contents, gsize length, gsize skip_start, gsize skip_end,
+	GArray *deltas, guint line
+);
+
+// History delta name for a source, by path since names needn't be unique; paths are escaped,
+// since they may contain spaces
+gchar *hosts_source_delta_name(const gchar *path);
+
+// Source path of a history delta, or NULL if the delta is for an alias
+gchar *hosts_source_delta_parse(const gchar *alias);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,171 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <gtk/gtk.h>
+#include <libxfce4util/libxfce4util.h>
+#include <libxfce4panel/libxfce4panel.h>
+
+#include "hosts.h"
+#include "hosts-state.h"
+
+// Per-host state is kept in a few flat arrays rather than one allocation per host: names are
+// packed into a single blob indexed by offset, enabled flags are a bitset, and the menu callback
+// data is a table built alongside the names. Edits from the configuration dialog are rare, so
+// they simply repack the blob; opening the dropdown allocates nothing that outlives the menu.
+
+// Repack the names (which may point into the current blob) and resize the per-host arrays.
+// Enabled bits and expiry times are left for the caller to fill in
+static void state_pack(HostsPlugin *hosts, const gchar * const *names, guint count) {
+	// the last dropdown's items point into the toggle table, at indices about to change
+	if (hosts->menu) {
+		gtk_widget_destroy(hosts->menu);
+		hosts->menu = NULL;
+	}
+
+	gsize size = 0;
+	for (guint i = 0; i < count; i++)
+		size += strlen(names[i]) + 1;
+
+	gchar *blob = count ? g_malloc(size) : NULL;
+	guint32 *offsets = count ? g_new(guint32, count) : NULL;
+	gsize offset = 0;
+	for (guint i = 0; i < count; i++) {
+		gsize length = strlen(names[i]) + 1;
+		memcpy(blob + offset, names[i], length);
+		offsets[i] = offset;
+		offset += length;
+	}
+	g_free(hosts->name_blob);
+	g_free(hosts->name_offsets);
+	hosts->name_blob = blob;
+	hosts->name_offsets = offsets;
+
+	// always keep at least one word, so the bit accessors never see NULL
+	guint words = MAX((count + 31) / 32, 1);
+	guint old_words = hosts->enabled_bits ? MAX((hosts->n_names + 31) / 32, 1) : 0;
+	hosts->enabled_bits = g_renew(guint32, hosts->enabled_bits, words);
+	if (words > old_words)
+		memset(hosts->enabled_bits + old_words, 0, (words - old_words) * sizeof(guint32));
+	hosts->expires = g_renew(gint64, hosts->expires, MAX(count, 1));
+
+	// entries only depend on position, so growing the table just fills in the new tail
+	hosts->toggle_table = g_renew(HostToggleData, hosts->toggle_table, MAX(count, 1));
+	for (guint i = 0; i < count; i++) {
+		hosts->toggle_table[i].hosts = hosts;
+		hosts->toggle_table[i].index = i;
+	}
+	hosts->n_names = count;
+}
+
+// Pointers to every name in the blob, valid until the next repack
+static const gchar **state_names(HostsPlugin *hosts, guint extra) {
+	const gchar **names = g_new(const gchar *, hosts->n_names + extra);
+	for (guint i = 0; i < hosts->n_names; i++)
+		names[i] = hosts_name(hosts, i);
+	return names;
+}
+
+gint hosts_find(HostsPlugin *hosts, const gchar *name) {
+	for (guint i = 0; i < hosts->n_names; i++) {
+		if (strcmp(hosts_name(hosts, i), name) == 0)
+			return (gint) i;
+	}
+	return -1;
+}
+
+void hosts_set_names(HostsPlugin *hosts, gchar **names) {
+	guint count = names ? g_strv_length(names) : 0;
+	state_pack(hosts, (const gchar * const *) names, count);
+	memset(hosts->enabled_bits, 0, MAX((count + 31) / 32, 1) * sizeof(guint32));
+	memset(hosts->expires, 0, MAX(count, 1) * sizeof(gint64));
+}
+
+gchar **hosts_dup_names(HostsPlugin *hosts) {
+	gchar **names = g_new(gchar *, hosts->n_names + 1);
+	for (guint i = 0; i < hosts->n_names; i++)
+		names[i] = g_strdup(hosts_name(hosts, i));
+	names[hosts->n_names] = NULL;
+	return names;
+}
+
+void hosts_append(HostsPlugin *hosts, const gchar *name) {
+	guint count = hosts->n_names;
+	const gchar **names = state_names(hosts, 1);
+	names[count] = name;
+	state_pack(hosts, names, count + 1);
+	g_free(names);
+	hosts_set_enabled(hosts, count, FALSE);
+	hosts->expires[count] = 0;
+}
+
+void hosts_remove(HostsPlugin *hosts, guint index) {
+	g_return_if_fail(index < hosts->n_names);
+	guint count = hosts->n_names;
+	for (guint i = index; i + 1 < count; i++) {
+		hosts_set_enabled(hosts, i, hosts_is_enabled(hosts, i + 1));
+		hosts->expires[i] = hosts->expires[i + 1];
+	}
+	hosts_set_enabled(hosts, count - 1, FALSE);
+
+	const gchar **names = state_names(hosts, 0);
+	memmove(names + index, names + index + 1, (count - index - 1) * sizeof(const gchar *));
+	state_pack(hosts, names, count - 1);
+	g_free(names);
+}
+
+void hosts_swap(HostsPlugin *hosts, guint a, guint b) {
+	g_return_if_fail(a < hosts->n_names && b < hosts->n_names);
+	gboolean enabled = hosts_is_enabled(hosts, a);
+	hosts_set_enabled(hosts, a, hosts_is_enabled(hosts, b));
+	hosts_set_enabled(hosts, b, enabled);
+	gint64 expires = hosts->expires[a];
+	hosts->expires[a] = hosts->expires[b];
+	hosts->expires[b] = expires;
+
+	const gchar **names = state_names(hosts, 0);
+	const gchar *name = names[a];
+	names[a] = names[b];
+	names[b] = name;
+	state_pack(hosts, names, hosts->n_names);
+	g_free(names);
+}
+
+void hosts_state_free(HostsPlugin *hosts) {
+	g_free(hosts->name_blob);
+	g_free(hosts->name_offsets);
+	g_free(hosts->enabled_bits);
+	g_free(hosts->expires);
+	g_free(hosts->toggle_table);
+	hosts->name_blob = NULL;
+	hosts->name_offsets = NULL;
+	hosts->enabled_bits = NULL;
+	hosts->expires = NULL;
+	hosts->toggle_table = NULL;
+	hosts->n_names = 0;
+}
+
+void hosts_state_report(HostsPlugin *hosts) {
+#ifdef DEBUG
+	guint count = hosts->n_names;
+	gsize blob = count ? hosts->name_offsets[count - 1] + strlen(hosts_name(hosts, count - 1)) + 1 : 0;
+	gsize bytes = blob
+		+ count * (sizeof(guint32) + sizeof(gint64) + sizeof(HostToggleData))
+		+ MAX((count + 31) / 32, 1) * sizeof(guint32);
+
+	// resident pages are the second field of statm
+	glong resident = 0;
+	FILE *statm = fopen("/proc/self/statm", "r");
+	if (statm) {
+		if (fscanf(statm, "%*d %ld", &resident) != 1)
+			resident = 0;
+		fclose(statm);
+	}
+	DBG("%u hosts in %" G_GSIZE_FORMAT " bytes of state; %ld KiB resident",
+		count, bytes, resident * (sysconf(_SC_PAGESIZE) / 1024));
+#endif
+}
@@ -0,0 +1,49 @@
+#ifndef __HOSTS_STATE_H__
+#define __HOSTS_STATE_H__
+
+G_BEGIN_DECLS
+
+// Name of the i'th configured host
+static inline const gchar *hosts_name(HostsPlugin *hosts, guint i) {
+	return hosts->name_blob + hosts->name_offsets[i];
+}
+
+// Whether the i'th host is enabled
+static inline gboolean hosts_is_enabled(HostsPlugin *hosts, guint i) {
+	return (hosts->enabled_bits[i / 32] >> (i % 32)) & 1;
+}
+
+static inline void hosts_set_enabled(HostsPlugin *hosts, guint i, gboolean enabled) {
+	if (enabled)
+		hosts->enabled_bits[i / 32] |= 1u << (i % 32);
+	else
+		hosts->enabled_bits[i / 32] &= ~(1u << (i % 32));
+}
+
+// Index of a host by name, or -1 if it isn't configured
+gint hosts_find(HostsPlugin *hosts, const gchar *name);
+
+// Replace all hosts with names (may be NULL); they start disabled, without expiry
+void hosts_set_names(HostsPlugin *hosts, gchar **names);
+
+// NULL-terminated copy of all host names
+gchar **hosts_dup_names(HostsPlugin *hosts);
+
+// Add a host to the end of the list, disabled
+void hosts_append(HostsPlugin *hosts, const gchar *name);
+
+// Remove the host at index, shifting later hosts down
+void hosts_remove(HostsPlugin *hosts, guint index);
+
+// Swap the positions of two hosts, along with their enabled flags and expiry
+void hosts_swap(HostsPlugin *hosts, guint a, guint b);
+
+// Free all per-host state
+void hosts_state_free(HostsPlugin *hosts);
+
+// Log the size of the per-host state and the process's resident memory (debug builds)
+void hosts_state_report(HostsPlugin *hosts);
+
+G_END_DECLS
+
+#endif
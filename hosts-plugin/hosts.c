@@ -12,6 +12,12 @@
 
 #include "hosts.h"
 #include "hosts-dialogs.h"
+#include "hosts-propagate.h"
+#include "hosts-shared.h"
+#include "hosts-history.h"
+#include "hosts-expiry.h"
+#include "hosts-sources.h"
+#include "hosts-state.h"
 
 /* default settings */
 #define DEFAULT_SETTING1 NULL
@@ -40,17 +46,58 @@ void hosts_save(XfcePanelPlugin *plugin, HostsPlugin *hosts){
 	g_free (file);
 	if (G_LIKELY(rc != NULL)){
 		DBG("Saving settings");
-		if (hosts->names) {
-			xfce_rc_write_list_entry(rc, "names", hosts->names, NULL);
-			for (guint i = 0; hosts->names[i]; i++) {
-				xfce_rc_write_bool_entry(rc, hosts->names[i], hosts->enabled[i]);
+		if (hosts->n_names) {
+			gchar **names = hosts_dup_names(hosts);
+			xfce_rc_write_list_entry(rc, "names", names, NULL);
+			g_strfreev(names);
+			for (guint i = 0; i < hosts->n_names; i++) {
+				xfce_rc_write_bool_entry(rc, hosts_name(hosts, i), hosts_is_enabled(hosts, i));
 			}
+		} else
+			xfce_rc_delete_entry(rc, "names", FALSE);
+		xfce_rc_write_entry(rc, "flush_command", hosts->flush_command ? hosts->flush_command : "");
+		if (hosts->targets && hosts->targets[0])
+			xfce_rc_write_list_entry(rc, "targets", hosts->targets, NULL);
+		else
+			xfce_rc_delete_entry(rc, "targets", FALSE);
+		// expiry times for timed hosts
+		xfce_rc_delete_group(rc, "expires", FALSE);
+		if (hosts->n_names) {
+			xfce_rc_set_group(rc, "expires");
+			for (guint i = 0; i < hosts->n_names; i++) {
+				if (!hosts->expires[i])
+					continue;
+				gchar *expires = g_strdup_printf("%" G_GINT64_FORMAT, hosts->expires[i]);
+				xfce_rc_write_entry(rc, hosts_name(hosts, i), expires);
+				g_free(expires);
+			}
+			xfce_rc_set_group(rc, NULL);
+		}
+		// external sources, one group each
+		gchar **groups = xfce_rc_get_groups(rc);
+		for (guint i = 0; groups && groups[i]; i++) {
+			if (g_str_has_prefix(groups[i], "source:"))
+				xfce_rc_delete_group(rc, groups[i], FALSE);
 		}
+		g_strfreev(groups);
+		xfce_rc_write_int_entry(rc, "sources", (gint) hosts->sources->len);
+		for (guint i = 0; i < hosts->sources->len; i++) {
+			HostsSource *source = g_ptr_array_index(hosts->sources, i);
+			gchar *group = g_strdup_printf("source:%u", i);
+			xfce_rc_set_group(rc, group);
+			g_free(group);
+			xfce_rc_write_entry(rc, "name", source->name);
+			xfce_rc_write_entry(rc, "path", source->path);
+			xfce_rc_write_bool_entry(rc, "enabled", source->enabled);
+		}
+		xfce_rc_set_group(rc, NULL);
 		xfce_rc_close(rc);
 	}
 }
 
 static void hosts_read(HostsPlugin *hosts) {
+	gchar *default_flush_command = hosts_default_flush_command();
+
 	// get the plugin config file location
 	gchar *file = xfce_panel_plugin_save_location(hosts->plugin, TRUE);
 	if (G_LIKELY (file != NULL)) {
@@ -59,14 +106,40 @@ static void hosts_read(HostsPlugin *hosts) {
    		g_free(file);
    		if (G_LIKELY (rc != NULL)) {
 			// read the settings
-			hosts->names = xfce_rc_read_list_entry(rc, "names", NULL);
-			// not null? read booleans for each entry
-			if (hosts->names) {
-				hosts->enabled = g_new0(gboolean, g_strv_length(hosts->names));
-				for (guint i = 0; hosts->names[i]; i++) {
-					hosts->enabled[i] = xfce_rc_read_bool_entry(rc, hosts->names[i], FALSE);
-					DBG("Host %s is %s", hosts->names[i], hosts->enabled[i] ? "enabled" : "disabled");
+			gchar **names = xfce_rc_read_list_entry(rc, "names", NULL);
+			hosts_set_names(hosts, names);
+			g_strfreev(names);
+			// read booleans for each entry
+			if (hosts->n_names) {
+				for (guint i = 0; i < hosts->n_names; i++) {
+					const gchar *name = hosts_name(hosts, i);
+					hosts_set_enabled(hosts, i, xfce_rc_read_bool_entry(rc, name, FALSE));
+					DBG("Host %s is %s", name, hosts_is_enabled(hosts, i) ? "enabled" : "disabled");
 				}
+				// timed hosts that expired while not running are disabled by the startup sync
+				xfce_rc_set_group(rc, "expires");
+				for (guint i = 0; i < hosts->n_names; i++)
+					hosts->expires[i] = g_ascii_strtoll(xfce_rc_read_entry(rc, hosts_name(hosts, i), "0"), NULL, 10);
+				xfce_rc_set_group(rc, NULL);
+			}
+			hosts->flush_command = g_strdup(xfce_rc_read_entry(rc, "flush_command", default_flush_command));
+			g_free(default_flush_command);
+			hosts->targets = xfce_rc_read_list_entry(rc, "targets", NULL);
+			// external sources
+			gint sources = xfce_rc_read_int_entry(rc, "sources", 0);
+			for (gint i = 0; i < sources; i++) {
+				gchar *group = g_strdup_printf("source:%d", i);
+				if (xfce_rc_has_group(rc, group)) {
+					xfce_rc_set_group(rc, group);
+					const gchar *path = xfce_rc_read_entry(rc, "path", NULL);
+					if (path) {
+						HostsSource *source = hosts_source_new(xfce_rc_read_entry(rc, "name", path), path);
+						source->enabled = xfce_rc_read_bool_entry(rc, "enabled", FALSE);
+						g_ptr_array_add(hosts->sources, source);
+					}
+					xfce_rc_set_group(rc, NULL);
+				}
+				g_free(group);
 			}
 			xfce_rc_close (rc);
 			return;
@@ -75,11 +148,11 @@ static void hosts_read(HostsPlugin *hosts) {
 
 	// fallback when no settings found
 	DBG("Failed to load settings; assuming no hosts configured");
-	hosts->names = NULL;
-	hosts->enabled = NULL;
+	hosts_set_names(hosts, NULL);
+	hosts->flush_command = default_flush_command;
 }
 
-static gboolean execute_sudo_command(const char *command, GError **error) {
+static gboolean execute_sudo_command(const char *command, gchar **output, GError **error) {
     // 1. Construct the sudo command
     // Important: Use a safe way to build the command to avoid shell injection!
     // Never just concatenate strings directly.
@@ -107,8 +180,10 @@ static gboolean execute_sudo_command(const char *command, GError **error) {
                         "Command failed with exit status %d. Error: %s",
                         exit_status, standard_error ? standard_error : "Unknown");
             success = FALSE;
+        } else if (output) {
+          *output = standard_output;
+          standard_output = NULL;
         } else {
-          // If needed, you can process standard_output here
           g_print("Command output: %s\n", standard_output ? standard_output : "");
         }
     } else {
@@ -123,37 +198,161 @@ static gboolean execute_sudo_command(const char *command, GError **error) {
     return success;
 }
 
-// Sync the /etc/hosts file with the current configured hosts and which are enabled/disabled.
-// This syncs the entire file, as there could be modifications made outside of the plugin that
-// override this plugin's changes. Returns false and shows a dialog message if unsuccessful.
-gboolean etc_hosts_sync(HostsPlugin *hosts) {
-	// nothing to sync?
-	if (!hosts->names)
-		return TRUE;
+// One hosts-format file being synced; filled in by hosts_sync_target on a worker thread
+typedef struct {
+	HostsPlugin *hosts;
+	// file to rewrite, and where its new contents are staged for the privileged copy
+	const gchar *path;
+	gchar *staged;
+	// digest of the enabled external sources, and the sources configured in any instance (NULL if
+	// this one has none), computed up front on the main thread
+	const gchar *sources_digest;
+	GHashTable *sources_configured;
+	gboolean modified;
+	// checksums before/after, and aliases changed on the managed localhost line, for the history
+	gchar *base_checksum;
+	gchar *result_checksum;
+	GArray *deltas;
+	// alias -> HostsConflict for aliases mapped on other address lines; only for /etc/hosts
+	GHashTable *conflicts;
+	GError *error;
+} HostsSyncTarget;
+
+static void hosts_conflict_free(HostsConflict *conflict) {
+	g_free(conflict->address);
+	g_free(conflict);
+}
+
+gchar *hosts_conflict_describe(HostsPlugin *hosts, const gchar *alias) {
+	HostsConflict *conflict = hosts->conflicts ? g_hash_table_lookup(hosts->conflicts, alias) : NULL;
+	if (!conflict)
+		return NULL;
+	return g_strdup_printf(
+		conflict->shadows
+			? "Shadowed by %s on line %u of /etc/hosts"
+			: "Also mapped to %s on line %u of /etc/hosts",
+		conflict->address, conflict->line
+	);
+}
 
-	DBG("Syncing /etc/hosts");
+// Record configured aliases that appear on a non-localhost line. The index maps alias -> index+1
+static void hosts_index_line(
+	GHashTable *index, GHashTable *conflicts, const gchar *line, const gchar *end,
+	guint line_number, gboolean shadows
+){
+	// hostnames are at most 255 characters; addresses are much shorter
+	gchar address[256], host[256];
+	gboolean have_address = FALSE;
+	for (const gchar *p = line; p < end;) {
+		while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+			p++;
+		if (p >= end || *p == '#')
+			break;
+		const gchar *token = p;
+		while (p < end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '#')
+			p++;
+		gsize length = p - token;
+		if (length >= sizeof(host))
+			continue;
+		if (!have_address) {
+			memcpy(address, token, length);
+			address[length] = '\0';
+			// other loopback lines (e.g. 127.0.1.1, ::1) still resolve locally
+			if (g_str_has_prefix(address, "127.") || g_strcmp0(address, "::1") == 0)
+				return;
+			have_address = TRUE;
+			continue;
+		}
+		memcpy(host, token, length);
+		host[length] = '\0';
+		gpointer key;
+		if (g_hash_table_lookup_extended(index, host, &key, NULL) && !g_hash_table_contains(conflicts, key)) {
+			HostsConflict *conflict = g_new(HostsConflict, 1);
+			conflict->address = g_strdup(address);
+			conflict->line = line_number;
+			conflict->shadows = shadows;
+			g_hash_table_insert(conflicts, g_strdup(key), conflict);
+		}
+	}
+}
 
-	// Read file; split line-by-line; should have read permissions to /etc/hosts
+// Append the lines in [start, end) to print, each prefixed with "> "
+static void hosts_print_lines(GString *print, const gchar *start, const gchar *end) {
+	for (const gchar *line = start; line < end;) {
+		const gchar *newline = memchr(line, '\n', end - line);
+		const gchar *line_end = newline ? newline : end;
+		g_string_append(print, "> ");
+		g_string_append_len(print, line, line_end - line);
+		g_string_append_c(print, '\n');
+		line = newline ? newline + 1 : end;
+	}
+}
+
+// Rebuild one hosts file from the configured hosts and sources, staging it if anything changed.
+// This only reads from the plugin state, so several targets can be rewritten in parallel.
+static void hosts_sync_target(HostsSyncTarget *target, gpointer user_data) {
+	HostsPlugin *hosts = target->hosts;
+	DBG("Syncing %s", target->path);
+
+	// Read file; should have read permissions to the target
 	gsize length;
-	GError *error = NULL;
 	gchar *contents = NULL;
-	if (!g_file_get_contents("/etc/hosts", &contents, &length, &error)) {
-		g_warning("Failed to read /etc/hosts: %s", error->message);
-		g_error_free(error);
-		return FALSE;
+	if (!g_file_get_contents(target->path, &contents, &length, &target->error))
+		return;
+	target->base_checksum = g_compute_checksum_for_data(G_CHECKSUM_SHA256, (const guchar *) contents, length);
+	target->deltas = hosts_delta_array_new();
+
+	// Byte range of the existing sources block, and the digest it was tagged with
+	gsize block_start = length, block_end = length;
+	gchar *block_digest = NULL;
+
+	// Index of configured aliases, to find them on other address lines in the same pass
+	GHashTable *alias_index = NULL;
+	if (target->conflicts) {
+		alias_index = g_hash_table_new(g_str_hash, g_str_equal);
+		for (guint k = 0; k < hosts->n_names; k++)
+			g_hash_table_add(alias_index, (gpointer) hosts_name(hosts, k));
 	}
-	gchar **lines = g_strsplit(contents, "\n", -1);
-	guint lines_length = g_strv_length(lines);
-	g_free(contents);
 
-	// Rebuild the file with modified lines
+	// Rebuild the file line-by-line. Lines are scanned in place rather than split, since the
+	// sources block can make up most of the file
 	gboolean localhost_seen = FALSE;
 	gboolean modified = FALSE;
-	gchar **new_lines = g_new0(gchar *, lines_length + 2); // one extra line in case we need to add another
-	for (guint i = 0; lines[i]; i++) {
-		if (g_str_has_prefix(lines[i], "127.0.0.1")) {
+	GString *out = g_string_sized_new(length + 256);
+	const gchar *end = contents + length;
+	// line number in the new file, for the history, and the current line in the old file
+	guint out_lines = 0, in_line = 0;
+	for (const gchar *line = contents; line < end;) {
+		const gchar *newline = memchr(line, '\n', end - line);
+		const gchar *line_end = newline ? newline : end;
+		const gchar *next = newline ? newline + 1 : end;
+		gsize line_length = line_end - line;
+		in_line++;
+
+		if (block_digest == NULL && line_length >= strlen(HOSTS_SOURCES_BEGIN)
+			&& strncmp(line, HOSTS_SOURCES_BEGIN, strlen(HOSTS_SOURCES_BEGIN)) == 0
+		) {
+			// skip over the sources block; it is re-appended at the end of the file
+			block_digest = g_strstrip(g_strndup(line + strlen(HOSTS_SOURCES_BEGIN), line_length - strlen(HOSTS_SOURCES_BEGIN)));
+			block_start = line - contents;
+			const gchar *block_close = g_strstr_len(line, end - line, "\n" HOSTS_SOURCES_END);
+			if (block_close) {
+				const gchar *close_end = memchr(block_close + 1, '\n', end - block_close - 1);
+				next = close_end ? close_end + 1 : end;
+			}
+			else next = end;
+			block_end = next - contents;
+			// the merge leaves out configured aliases, so there are no conflicts to find inside
+			for (const gchar *p = line_end; p < next - 1; p++) {
+				if (*p == '\n')
+					in_line++;
+			}
+		}
+		else if (line_length >= 9 && strncmp(line, "127.0.0.1", 9) == 0) {
 			GHashTable *hosts_set = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
-			gchar **tokens = g_strsplit_set(lines[i], " \t", -1);
+			gchar *line_copy = g_strndup(line, line_length);
+			gchar **tokens = g_strsplit_set(line_copy, " \t", -1);
+			g_free(line_copy);
 
 			// Add all hosts from the line to the set
 			for (guint k = 1; tokens[k] != NULL; k++) {
@@ -161,25 +360,29 @@ gboolean etc_hosts_sync(HostsPlugin *hosts) {
 			}
 
 			// Add enabled hosts
-			for (guint k = 0; hosts->names[k] != NULL; k++) {
+			for (guint k = 0; k < hosts->n_names; k++) {
+				const gchar *name = hosts_name(hosts, k);
 				// only add if its the first time we see localhost
-				if (!localhost_seen && hosts->enabled[k])
-					modified |= g_hash_table_add(hosts_set, g_strdup(hosts->names[k]));
-				else
-					modified |= g_hash_table_remove(hosts_set, hosts->names[k]);
+				gboolean add = !localhost_seen && hosts_is_enabled(hosts, k);
+				gboolean changed = add
+					? g_hash_table_add(hosts_set, g_strdup(name))
+					: g_hash_table_remove(hosts_set, name);
+				modified |= changed;
+				// duplicates removed from later localhost lines aren't user-visible changes
+				if (changed && !localhost_seen)
+					hosts_delta_append(target->deltas, add, out_lines, name);
 			}
 
 			// Create the new line
-			GString *new_line = g_string_new(tokens[0]);
+			g_string_append(out, tokens[0]);
 			GHashTableIter iter;
 			gpointer key;
 			g_hash_table_iter_init(&iter, hosts_set);
 			while (g_hash_table_iter_next(&iter, &key, NULL)) {
-				g_string_append_printf(new_line, " %s", (gchar *)key);
+				g_string_append_printf(out, " %s", (gchar *)key);
 			}
-
-			// Add the new line to the new_lines array
-			new_lines[i] = g_string_free(new_line, FALSE);
+			g_string_append_c(out, '\n');
+			out_lines++;
 
 			// Cleanup
 			g_strfreev(tokens);
@@ -187,75 +390,325 @@ gboolean etc_hosts_sync(HostsPlugin *hosts) {
 
 			localhost_seen = TRUE;
 		} else {
-			new_lines[i] = g_strdup(lines[i]);
+			if (alias_index)
+				hosts_index_line(alias_index, target->conflicts, line, line_end, in_line, !localhost_seen);
+			g_string_append_len(out, line, line_length);
+			g_string_append_c(out, '\n');
+			out_lines++;
 		}
+		line = next;
 	}
-	g_strfreev(lines);
+	// keep the file's trailing newline (or lack of one) as it was
+	if (out->len && (length == 0 || contents[length - 1] != '\n') && block_end < length)
+		g_string_truncate(out, out->len - 1);
 
 	// no localhost line found; add one
-	if (!localhost_seen) {
+	if (!localhost_seen && hosts->n_names) {
 		modified = TRUE;
-		GString *new_line = g_string_new("127.0.0.1");
-		for (guint k = 0; hosts->names[k] != NULL; k++) {
-			if (hosts->enabled[k]) {
-				g_string_append_printf(new_line, " %s", hosts->names[k]);
+		if (out->len && out->str[out->len - 1] != '\n')
+			g_string_append_c(out, '\n');
+		g_string_append(out, "127.0.0.1");
+		for (guint k = 0; k < hosts->n_names; k++) {
+			if (hosts_is_enabled(hosts, k)) {
+				g_string_append_printf(out, " %s", hosts_name(hosts, k));
+				hosts_delta_append(target->deltas, TRUE, out_lines, hosts_name(hosts, k));
 			}
 		}
-		new_lines[lines_length] = g_string_free(new_line, FALSE);
-		new_lines[lines_length+1] = NULL;
+		g_string_append_c(out, '\n');
 	}
-	else new_lines[lines_length] = NULL;
 
-	// Don't write the file (which will prompt for sudo access) if no modifications were made
+	// (Re)append the sources block; it only needs merging if the sources changed. Instances
+	// without any sources configured leave the block alone, so they don't drop another's, and
+	// the merge leaves other instances' sub-blocks alone
+	const gchar *sources_digest = target->sources_digest;
+	if (out->len && out->str[out->len - 1] != '\n' && (sources_digest || block_digest))
+		g_string_append_c(out, '\n');
+	gsize out_block_start = out->len;
+	if (block_digest && (!hosts->sources->len || g_strcmp0(block_digest, sources_digest) == 0)) {
+		DBG("External sources unchanged in %s", target->path);
+		g_string_append_len(out, contents + block_start, block_end - block_start);
+		// the block was moved if anything followed it
+		modified |= block_end < length;
+	}
+	// merge, or drop the block if the sources were all disabled
+	else if (sources_digest || block_digest) {
+		hosts_sources_merge(
+			hosts, out, target->sources_configured, contents, length, block_start, block_end,
+			target->deltas, out_lines
+		);
+		// another instance's sources make the digests differ without anything having changed
+		modified |= block_end < length || out->len - out_block_start != block_end - block_start
+			|| memcmp(out->str + out_block_start, contents + block_start, block_end - block_start) != 0;
+	}
+	gsize out_block_end = out->len;
+	g_free(block_digest);
+	g_free(contents);
+	if (alias_index)
+		g_hash_table_destroy(alias_index);
+
+	// Don't stage the file (which will prompt for sudo access) if no modifications were made
+	target->modified = modified;
 	if (!modified) {
-		DBG("No modifications to /etc/hosts needed");
-		g_strfreev(new_lines);
+		DBG("No modifications to %s needed", target->path);
+		g_string_free(out, TRUE);
+		return;
+	}
+
+	// print the new file, leaving out the (possibly huge) sources block
+	GString *print = g_string_new(NULL);
+	g_string_append_printf(print, "New %s file:\n", target->path);
+	hosts_print_lines(print, out->str, out->str + out_block_start);
+	if (out_block_end > out_block_start) {
+		const gchar *block = out->str + out_block_start;
+		const gchar *first_end = memchr(block, '\n', out_block_end - out_block_start);
+		hosts_print_lines(print, block, first_end ? first_end : out->str + out_block_end);
+		g_string_append(print, "> ...\n");
+		g_string_append_printf(print, "> %s\n", HOSTS_SOURCES_END);
+	}
+	g_print("%s", print->str);
+	g_string_free(print, TRUE);
+
+	// write tmp file, to be copied over the target using sudo
+	target->result_checksum = g_compute_checksum_for_data(G_CHECKSUM_SHA256, (const guchar *) out->str, out->len);
+	g_file_set_contents(target->staged, out->str, out->len, &target->error);
+	g_string_free(out, TRUE);
+}
+
+// Sync the /etc/hosts file, plus any additional hosts-format targets, with the current configured
+// hosts and sources. This syncs the entire files, as there could be modifications made outside of
+// the plugin that override this plugin's changes. Targets are rewritten in parallel, and only
+// changed ones are copied into place, all with a single authorization. Callers hold the shared
+// write lock (hosts_shared_run), since the staging files are shared by all instances. Returns
+// false and shows a dialog message if /etc/hosts couldn't be synced; errors for the other targets
+// are shown but don't fail the sync.
+gboolean etc_hosts_sync(HostsPlugin *hosts) {
+	// nothing to sync?
+	if (!hosts->n_names && !hosts->sources->len)
 		return TRUE;
+
+	// Digest of the external sources that should be merged; NULL if none are enabled. Computed
+	// here since it updates the sources' cached checksums
+	gchar *sources_digest = hosts_sources_digest(hosts);
+	GHashTable *sources_configured = hosts->sources->len ? hosts_shared_configured(hosts) : NULL;
+
+	guint count = 1 + (hosts->targets ? g_strv_length(hosts->targets) : 0);
+	HostsSyncTarget *targets = g_new0(HostsSyncTarget, count);
+	for (guint i = 0; i < count; i++) {
+		targets[i].hosts = hosts;
+		targets[i].path = i ? hosts->targets[i - 1] : "/etc/hosts";
+		targets[i].staged = hosts_shared_stage_path(i);
+		targets[i].sources_digest = sources_digest;
+		targets[i].sources_configured = sources_configured;
 	}
+	// find shadowed aliases while rewriting /etc/hosts
+	targets[0].conflicts = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify) hosts_conflict_free);
 
-	g_print("New /etc/hosts file:\n");
-	for (guint i = 0; new_lines[i]; i++)
-		g_print("> %s\n", new_lines[i]);
+	// Rewrite all targets on a worker pool; a single target is done in place
+	if (count == 1)
+		hosts_sync_target(&targets[0], NULL);
+	else {
+		GThreadPool *pool = g_thread_pool_new(
+			(GFunc) hosts_sync_target, NULL, MIN(count, g_get_num_processors()), FALSE, NULL
+		);
+		for (guint i = 0; i < count; i++)
+			g_thread_pool_push(pool, &targets[i], NULL);
+		// wait for all to finish
+		g_thread_pool_free(pool, FALSE, TRUE);
+	}
 
-	// write new contents to file
-	gchar *new_contents = g_strjoinv("\n", new_lines);
-	g_strfreev(new_lines);
+	// Copy all changed targets into place with one privileged command. The helper writes
+	// /etc/hosts first and skips the rest if that fails; if /etc/hosts couldn't even be rebuilt,
+	// nothing is written, since the caller reverts its change
+	GString *command = g_string_new(HOSTS_COMMIT_HELPER);
+	guint *staged = g_new(guint, count);
+	guint staged_count = 0;
+	for (guint i = 0; i < count && !targets[0].error; i++) {
+		if (targets[i].error || !targets[i].modified)
+			continue;
+		gchar *staged_quoted = g_shell_quote(targets[i].staged);
+		gchar *path_quoted = g_shell_quote(targets[i].path);
+		g_string_append_printf(command, " %s %s", staged_quoted, path_quoted);
+		g_free(staged_quoted);
+		g_free(path_quoted);
+		staged[staged_count++] = i;
+	}
+	GError *error = NULL;
+	gchar *output = NULL;
+	gboolean committed = !staged_count || execute_sudo_command(command->str, &output, &error);
+	hosts->written = g_get_monotonic_time();
+	g_string_free(command, TRUE);
+
+	// The helper prints a status line per target, in order. A missing line means it never got
+	// that far; if the helper couldn't run at all (e.g. authorization was dismissed), every
+	// target failed with that error
+	gchar **status = output ? g_strsplit(output, "\n", -1) : NULL;
+	guint status_count = status ? g_strv_length(status) : 0;
+	for (guint k = 0; k < staged_count; k++) {
+		HostsSyncTarget *target = &targets[staged[k]];
+		const gchar *line = k < status_count ? status[k] : NULL;
+		if (!committed)
+			target->error = g_error_copy(error);
+		else if (!line || !*line)
+			target->error = g_error_new(G_IO_ERROR, G_IO_ERROR_FAILED, "not written");
+		else if (g_str_has_prefix(line, "failed: "))
+			target->error = g_error_new(G_IO_ERROR, G_IO_ERROR_FAILED, "%s", line + strlen("failed: "));
+		else if (g_strcmp0(line, "ok") != 0)
+			target->error = g_error_new(G_IO_ERROR, G_IO_ERROR_FAILED, "%s", line);
+	}
+	g_strfreev(status);
+	g_free(output);
+	g_free(staged);
+
+	// keep the previous conflicts if /etc/hosts couldn't be read
+	if (targets[0].base_checksum) {
+		if (hosts->conflicts)
+			g_hash_table_unref(hosts->conflicts);
+		hosts->conflicts = g_hash_table_ref(targets[0].conflicts);
+		GHashTableIter iter;
+		gpointer key, value;
+		g_hash_table_iter_init(&iter, hosts->conflicts);
+		while (g_hash_table_iter_next(&iter, &key, &value)) {
+			HostsConflict *conflict = (HostsConflict *) value;
+			g_warning(
+				"%s is mapped to %s on line %u of /etc/hosts%s", (gchar *) key, conflict->address,
+				conflict->line, conflict->shadows ? ", which shadows the localhost alias" : ""
+			);
+		}
+	}
+
+	// only /etc/hosts decides success; the other targets just get a warning
+	gboolean success = !targets[0].error;
 
-	gboolean success = FALSE;
-	// write tmp file, then copy to /etc/hosts using sudo
-	if (g_file_set_contents("/tmp/xfce-hosts-plugin_etc_hosts", new_contents, -1, &error))
-		success = execute_sudo_command("cp /tmp/xfce-hosts-plugin_etc_hosts /etc/hosts", &error);
-	g_free(new_contents);
+	// undo/restore drop their entries from the history instead of recording new ones
+	if (success && targets[0].modified && !hosts->history_replaying)
+		hosts_history_record(targets[0].base_checksum, targets[0].result_checksum, targets[0].deltas);
 
-	if (!success) {
+	// report errors per target
+	GString *errors = g_string_new(NULL);
+	for (guint i = 0; i < count; i++) {
+		if (targets[i].error) {
+			g_warning("Failed to sync %s: %s", targets[i].path, targets[i].error->message);
+			g_string_append_printf(errors, "\n%s: %s", targets[i].path, targets[i].error->message);
+		}
+	}
+	if (errors->len && !hosts->sync_quiet) {
 		// Open a dialog with the error message
 		GtkWidget *dialog = gtk_message_dialog_new(
 			NULL,
 			GTK_DIALOG_DESTROY_WITH_PARENT,
-			GTK_MESSAGE_ERROR,
+			success ? GTK_MESSAGE_WARNING : GTK_MESSAGE_ERROR,
 			GTK_BUTTONS_CLOSE,
-			"xfce-hosts-plugin couldn't sync with /etc/hosts: %s", error->message
+			"xfce-hosts-plugin couldn't sync with %s:%s",
+			success ? "some hosts files" : "/etc/hosts", errors->str
 		);
 		gtk_dialog_run(GTK_DIALOG(dialog));
 		gtk_widget_destroy(dialog);
+	}
+	g_string_free(errors, TRUE);
+	if (error)
 		g_error_free(error);
+
+	for (guint i = 0; i < count; i++) {
+		g_free(targets[i].staged);
+		g_free(targets[i].base_checksum);
+		g_free(targets[i].result_checksum);
+		if (targets[i].deltas)
+			g_array_unref(targets[i].deltas);
+		if (targets[i].conflicts)
+			g_hash_table_unref(targets[i].conflicts);
+		if (targets[i].error)
+			g_error_free(targets[i].error);
 	}
+	g_free(targets);
+	g_free(sources_digest);
+	if (sources_configured)
+		g_hash_table_unref(sources_configured);
 
 	return success;
 }
 
+// A host or source being toggled, by name (path for sources), once the write lock is free
+typedef struct {
+	gchar *name;
+	gboolean active;
+} HostsToggleChange;
+
+static HostsToggleChange *hosts_toggle_change_new(const gchar *name, gboolean active) {
+	HostsToggleChange *change = g_new(HostsToggleChange, 1);
+	change->name = g_strdup(name);
+	change->active = active;
+	return change;
+}
+
+static void hosts_toggle_change_free(HostsToggleChange *change) {
+	g_free(change->name);
+	g_free(change);
+}
+
+static gboolean hosts_toggle_apply(HostsPlugin *hosts, HostsToggleChange *change) {
+	gint index = hosts_find(hosts, change->name);
+	// removed, or already toggled by another instance, while waiting for the lock
+	if (index < 0 || hosts_is_enabled(hosts, index) == change->active)
+		return FALSE;
+	hosts_set_enabled(hosts, index, change->active);
+	// revert if /etc/hosts sync fails
+	if (!etc_hosts_sync(hosts)) {
+		hosts_set_enabled(hosts, index, !change->active);
+		return FALSE;
+	}
+	// toggling by hand cancels any expiry
+	if (hosts->expires[index]) {
+		hosts_expiry_set(hosts, index, 0);
+		hosts_save(hosts->plugin, hosts);
+	}
+	// measure how long until resolvers pick up the change
+	const gchar *alias = hosts_name(hosts, index);
+	hosts_propagate(hosts, &alias, &change->active, 1);
+	return TRUE;
+}
+
 // Callback for toggling a host
 static void hosts_toggle(GtkCheckMenuItem *menu_item, HostToggleData *data) {
     gboolean active = gtk_check_menu_item_get_active(menu_item);
 	// don't do anything if state matches
-	if (data->hosts->enabled[data->index] == active)
+	if (hosts_is_enabled(data->hosts, data->index) == active)
 		return;
-	data->hosts->enabled[data->index] = active;
+	hosts_shared_run(
+		data->hosts, (HostsSharedFunc) hosts_toggle_apply,
+		hosts_toggle_change_new(hosts_name(data->hosts, data->index), active), (GDestroyNotify) hosts_toggle_change_free
+	);
+}
+
+static gboolean hosts_source_toggle_apply(HostsPlugin *hosts, HostsToggleChange *change) {
+	HostsSource *source = NULL;
+	for (guint i = 0; i < hosts->sources->len && !source; i++) {
+		if (g_strcmp0(((HostsSource *) g_ptr_array_index(hosts->sources, i))->path, change->name) == 0)
+			source = g_ptr_array_index(hosts->sources, i);
+	}
+	// removed while waiting for the lock
+	if (!source || source->enabled == change->active)
+		return FALSE;
+	source->enabled = change->active;
 	// revert if /etc/hosts sync fails
-	if (!etc_hosts_sync(data->hosts)) {
-		data->hosts->enabled[data->index] = !active;
-		gtk_check_menu_item_set_active(menu_item, !active);
+	if (!etc_hosts_sync(hosts)) {
+		source->enabled = !change->active;
+		return FALSE;
 	}
+	return TRUE;
+}
+
+// Callback for toggling an external source
+static void hosts_source_toggle(GtkCheckMenuItem *menu_item, HostsPlugin *hosts) {
+	guint index = GPOINTER_TO_UINT(g_object_get_data(G_OBJECT(menu_item), "source"));
+	HostsSource *source = g_ptr_array_index(hosts->sources, index);
+	gboolean active = gtk_check_menu_item_get_active(menu_item);
+	// don't do anything if state matches
+	if (source->enabled == active)
+		return;
+	hosts_shared_run(
+		hosts, (HostsSharedFunc) hosts_source_toggle_apply,
+		hosts_toggle_change_new(source->path, active), (GDestroyNotify) hosts_toggle_change_free
+	);
 }
 
 // Show dropdown with hosts that can be toggled
@@ -263,19 +716,48 @@ static void hosts_dropdown(GtkWidget *widget, gpointer data) {
 	HostsPlugin *hosts =  (HostsPlugin*) data;
 	GtkWidget *menu;
 
+	// menus are rebuilt on every click, so drop the previous one rather than keep them all alive
+	if (hosts->menu)
+		gtk_widget_destroy(hosts->menu);
 	menu = gtk_menu_new();
+	hosts->menu = menu;
 
 	// dynamic list element for each configured host
-	if (hosts->names) {
-		for (guint i = 0; hosts->names[i]; i++) {
-			GtkWidget *menu_item = gtk_check_menu_item_new_with_label(hosts->names[i]);
-			gtk_check_menu_item_set_active(GTK_CHECK_MENU_ITEM(menu_item), hosts->enabled[i]);
+	if (hosts->n_names) {
+		for (guint i = 0; i < hosts->n_names; i++) {
+			GString *label = g_string_new(hosts_name(hosts, i));
+			if (hosts->expires[i]) {
+				GDateTime *expires = g_date_time_new_from_unix_local(hosts->expires[i]);
+				gchar *until = g_date_time_format(expires, "%H:%M");
+				g_string_append_printf(label, " (until %s%s)", until, hosts_expiry_pending(hosts, i) ? ", pending" : "");
+				g_free(until);
+				g_date_time_unref(expires);
+			}
+			// flag aliases mapped elsewhere in /etc/hosts
+			gchar *conflict = hosts_conflict_describe(hosts, hosts_name(hosts, i));
+			if (conflict)
+				g_string_append(label, " \xe2\x9a\xa0");
+			GtkWidget *menu_item = gtk_check_menu_item_new_with_label(label->str);
+			g_string_free(label, TRUE);
+			gtk_widget_set_tooltip_text(menu_item, conflict);
+			g_free(conflict);
+			gtk_check_menu_item_set_active(GTK_CHECK_MENU_ITEM(menu_item), hosts_is_enabled(hosts, i));
+			gtk_menu_shell_append(GTK_MENU_SHELL(menu), menu_item);
+			g_signal_connect(menu_item, "toggled", G_CALLBACK(hosts_toggle), &hosts->toggle_table[i]);
+		}
+	}
+
+	// external sources, toggled the same way
+	if (hosts->sources->len) {
+		gtk_menu_shell_append(GTK_MENU_SHELL(menu), gtk_separator_menu_item_new());
+		for (guint i = 0; i < hosts->sources->len; i++) {
+			HostsSource *source = g_ptr_array_index(hosts->sources, i);
+			GtkWidget *menu_item = gtk_check_menu_item_new_with_label(source->name);
+			gtk_widget_set_tooltip_text(menu_item, source->path);
+			gtk_check_menu_item_set_active(GTK_CHECK_MENU_ITEM(menu_item), source->enabled);
+			g_object_set_data(G_OBJECT(menu_item), "source", GUINT_TO_POINTER(i));
+			g_signal_connect(menu_item, "toggled", G_CALLBACK(hosts_source_toggle), hosts);
 			gtk_menu_shell_append(GTK_MENU_SHELL(menu), menu_item);
-			HostToggleData *toggle_data = g_new(HostToggleData, 1);
-			toggle_data->hosts = hosts;
-			toggle_data->index = i;
-			g_signal_connect(menu_item, "toggled", G_CALLBACK(hosts_toggle), toggle_data);
-			g_object_set_data_full(G_OBJECT(menu_item), "toggle_data", toggle_data, g_free);
 		}
 	}
 
@@ -284,6 +766,12 @@ static void hosts_dropdown(GtkWidget *widget, gpointer data) {
 	gtk_menu_shell_append(GTK_MENU_SHELL(menu), separator);
 	gtk_widget_show(separator);
 
+	// Enable hosts for a limited time
+	hosts_expiry_menu(hosts, menu);
+
+	// Undo / restore from the history of changes
+	hosts_history_menu(hosts, menu);
+
 	// Add the 'Configure...' menu item
 	GtkWidget *configure_item = gtk_menu_item_new_with_label("Configure...");
 	gtk_menu_shell_append(GTK_MENU_SHELL(menu), configure_item);
@@ -291,9 +779,37 @@ static void hosts_dropdown(GtkWidget *widget, gpointer data) {
 	gtk_widget_show(configure_item);
 
 	gtk_widget_show_all(menu);
+	hosts_state_report(hosts);
 	gtk_menu_popup_at_widget(GTK_MENU(menu), hosts->button, GDK_GRAVITY_SOUTH_WEST, GDK_GRAVITY_NORTH_WEST, NULL);
 }
 
+// Sync once at startup; queued like any other change while another instance holds the lock
+static gboolean hosts_startup_sync(HostsPlugin *hosts, gpointer data) {
+	// Disable timed hosts that expired while not running. This comes after the merge, since the
+	// state other instances last published may still have them enabled
+	GArray *expired = g_array_new(FALSE, FALSE, sizeof(guint));
+	for (guint i = 0; i < hosts->n_names; i++) {
+		if (hosts_expiry_pending(hosts, i) && hosts_is_enabled(hosts, i)) {
+			DBG("Host %s expired while not running", hosts_name(hosts, i));
+			hosts_set_enabled(hosts, i, FALSE);
+			g_array_append_val(expired, i);
+		}
+	}
+	gboolean success = etc_hosts_sync(hosts);
+	// expiry times are only cleared once the write went through; otherwise the timer retries them
+	for (guint k = 0; k < expired->len; k++) {
+		guint i = g_array_index(expired, guint, k);
+		if (success)
+			hosts->expires[i] = 0;
+		else
+			hosts_set_enabled(hosts, i, TRUE);
+	}
+	if (success && expired->len)
+		hosts_save(hosts->plugin, hosts);
+	g_array_free(expired, TRUE);
+	return success;
+}
+
 /** Initialize the GTK widget for the plugin */
 static HostsPlugin *hosts_new (XfcePanelPlugin *plugin){
 	HostsPlugin   *hosts;
@@ -304,12 +820,18 @@ static HostsPlugin *hosts_new (XfcePanelPlugin *plugin){
 
 	// pointer to plugin
 	hosts->plugin = plugin;
+	hosts->propagation = g_cancellable_new();
+	hosts->sources = g_ptr_array_new_with_free_func((GDestroyNotify) hosts_source_free);
 
 	// Read the user settings
 	hosts_read(hosts);
 
-	// Sync, in case file was modified while not running
-	etc_hosts_sync(hosts);
+	// Sync, in case file was modified while not running; other instances may have newer state
+	hosts_shared_init(hosts);
+	hosts_shared_run(hosts, (HostsSharedFunc) hosts_startup_sync, NULL, NULL);
+
+	// Schedule timed hosts
+	hosts_expiry_init(hosts);
 
 	// Get the current orientation
 	orientation = xfce_panel_plugin_get_orientation (plugin);
@@ -350,19 +872,37 @@ static void hosts_free(XfcePanelPlugin *plugin, HostsPlugin *hosts) {
 	if (G_UNLIKELY(dialog != NULL))
 		gtk_widget_destroy (dialog);
 
+	// stop listening to other instances, and stop expiry timers
+	hosts_shared_free(hosts);
+	hosts_expiry_free(hosts);
+
+	// stop reporting propagation to widgets that are about to be destroyed
+	g_cancellable_cancel(hosts->propagation);
+	g_object_unref(hosts->propagation);
+
 	// destroy the panel widgets
 	gtk_widget_destroy(hosts->hvbox);
+	if (hosts->menu)
+		gtk_widget_destroy(hosts->menu);
 
 	// cleanup hosts configuration
-	if (G_LIKELY(hosts->names != NULL)){
-		g_strfreev(hosts->names);
-		g_free(hosts->enabled);
-	}
+	hosts_state_free(hosts);
+	g_free(hosts->flush_command);
+	g_ptr_array_unref(hosts->sources);
+	g_strfreev(hosts->targets);
+	if (hosts->conflicts)
+		g_hash_table_unref(hosts->conflicts);
 
 	// free the plugin structure
 	g_slice_free(HostsPlugin, hosts);
 }
 
+// Plugin was removed from the panel, rather than the panel just exiting
+static void hosts_removed(XfcePanelPlugin *plugin, HostsPlugin *hosts) {
+	// history deltas for aliases only we had configured can be dropped now
+	hosts_shared_unregister(hosts);
+}
+
 static void hosts_orientation_changed (
 	XfcePanelPlugin *plugin, GtkOrientation orientation, HostsPlugin *hosts
 ){
@@ -404,6 +944,7 @@ static void hosts_construct (XfcePanelPlugin *plugin) {
 	// connect plugin signals
 	g_signal_connect(G_OBJECT(plugin), "free-data", G_CALLBACK(hosts_free), hosts);
 	g_signal_connect(G_OBJECT(plugin), "save", G_CALLBACK(hosts_save), hosts);
+	g_signal_connect(G_OBJECT(plugin), "remove", G_CALLBACK(hosts_removed), hosts);
 	g_signal_connect(G_OBJECT(plugin), "size-changed", G_CALLBACK(hosts_size_changed), hosts);
 	g_signal_connect(G_OBJECT(plugin), "orientation-changed", G_CALLBACK(hosts_orientation_changed), hosts);
 
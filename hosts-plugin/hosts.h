@@ -3,8 +3,39 @@
 
 G_BEGIN_DECLS
 
-/* plugin structure */
+// Timer wheel for timed aliases; see hosts-expiry.c
+typedef struct _HostsExpiryWheel HostsExpiryWheel;
+
+// External hosts-format list merged into /etc/hosts; see hosts-sources.c
+typedef struct {
+	gchar *name;
+	// hosts file, or a directory of them
+	gchar *path;
+	gboolean enabled;
+	// cached checksum of the contents, valid while the file sizes/mtimes match signature
+	gchar *signature;
+	gchar *checksum;
+} HostsSource;
+
+// Another line of /etc/hosts that maps a configured alias to a different address
+typedef struct {
+	gchar *address;
+	// 1-based line number
+	guint line;
+	// the line comes before our localhost line, so it wins on lookup
+	gboolean shadows;
+} HostsConflict;
+
+typedef struct _HostsPlugin HostsPlugin;
+
+// Structure to indicate which host is being toggled
 typedef struct {
+	HostsPlugin *hosts;
+	guint index;
+} HostToggleData;
+
+/* plugin structure */
+struct _HostsPlugin {
 	XfcePanelPlugin *plugin;
 
 	/* panel widgets */
@@ -13,25 +44,62 @@ typedef struct {
 	GtkWidget       *icon;
 	GtkWidget		*button;
 
-	// hostnames
-	gchar           **names;
-	// which hosts are enabled
-	gboolean         *enabled;
+	// hostnames, packed NUL-terminated into one blob and located by offset; see hosts-state.c
+	gchar           *name_blob;
+	guint32         *name_offsets;
+	guint            n_names;
+	// which hosts are enabled, one bit each
+	guint32         *enabled_bits;
+	// when each host should be disabled (seconds since the epoch), or 0 to never expire
+	gint64           *expires;
+	HostsExpiryWheel *expiry;
+	// callback data for each host's menu item, reused by every dropdown
+	HostToggleData  *toggle_table;
+	// dropdown from the last click, destroyed when the next one is built
+	GtkWidget       *menu;
 
-} HostsPlugin;
+	// external sources (HostsSource), toggled like hosts
+	GPtrArray       *sources;
 
-// Structure to indicate which host is being toggled
-typedef struct {
-	HostsPlugin *hosts;
-	guint index;
-} HostToggleData;
+	// hosts-format files synced along with /etc/hosts, e.g. for containers
+	gchar           **targets;
+
+	// alias -> HostsConflict, found during the last sync of /etc/hosts
+	GHashTable      *conflicts;
+
+	// command run to flush resolver caches after /etc/hosts is written
+	gchar           *flush_command;
+	// cancels in-flight propagation checks when the plugin is freed
+	GCancellable    *propagation;
+	// when the last privileged write returned (monotonic), which propagation is measured from
+	gint64           written;
+
+	// last generation of shared state seen from other instances
+	guint64          shared_generation;
+	// watches for changes published by other instances
+	GFileMonitor    *shared_monitor;
+	// changes waiting for another instance to release the write lock, and the source retrying it
+	GQueue          *shared_pending;
+	guint            shared_retry;
+	// set while a change runs, so changes made meanwhile (e.g. from a dialog's main loop) queue
+	gboolean         shared_running;
+
+	// set while undoing changes, so the write isn't recorded in the history again
+	gboolean         history_replaying;
+	// set while retrying an unattended write, so a failure doesn't show the error dialog again
+	gboolean         sync_quiet;
+
+};
 
 // Save configuration
 void hosts_save(XfcePanelPlugin *plugin, HostsPlugin *hosts);
 
-// Update the /etc/hosts file
+// Update the /etc/hosts file, and any additional targets
 gboolean etc_hosts_sync(HostsPlugin *hosts);
 
+// Describe where an alias is mapped elsewhere in /etc/hosts, or NULL if it isn't
+gchar *hosts_conflict_describe(HostsPlugin *hosts, const gchar *alias);
+
 G_END_DECLS
 
 #endif
\ No newline at end of file